@@ -0,0 +1,116 @@
+#ifndef AES_CTR_H
+#define AES_CTR_H
+
+#include <AES.h>
+#include <Crypto.h>
+
+// AES in counter (CTR) mode behind one interface, with a software backend
+// on the Crypto library's AES and a SAMD51 hardware backend
+// (HardwareAesCtr.h).
+//
+// crypt() takes the 16-byte initial counter block and encrypts or decrypts
+// (the same operation in CTR mode) in place or out of place. The last 32
+// bits of the counter block are a big-endian block counter that is
+// incremented for each block, as in GCM. PlatformAesCtr is the hardware
+// backend on the SAMD51 and the software one elsewhere, so sketches can use
+// it and still build for boards without the AES peripheral.
+
+#define AES_BLOCK_SIZE 16
+
+class AesCtrCipher {
+public:
+  virtual ~AesCtrCipher() {}
+
+  // 16, 24 or 32 byte key; returns false for other lengths. The key
+  // schedule is kept until the next setKey() or clear().
+  virtual bool setKey(const uint8_t *key, size_t length) = 0;
+
+  virtual void crypt(const uint8_t *counter, const uint8_t *in, uint8_t *out, size_t length) = 0;
+
+  virtual void clear() = 0;
+
+  virtual const char *name() const = 0;
+};
+
+// Increment the 32-bit big-endian block counter at the end of a counter block
+inline void aesCtrIncrement(uint8_t *counter) {
+  for (int i = AES_BLOCK_SIZE - 1; i >= AES_BLOCK_SIZE - 4; i--) {
+    if (++counter[i] != 0) {
+      break;
+    }
+  }
+}
+
+// Advance the block counter by blocks, e.g. to the start of a later chunk
+inline void aesCtrAdd(uint8_t *counter, uint32_t blocks) {
+  uint32_t value = ((uint32_t)counter[12] << 24) | ((uint32_t)counter[13] << 16) |
+                   ((uint32_t)counter[14] << 8) | counter[15];
+  value += blocks;
+  counter[12] = (uint8_t)(value >> 24);
+  counter[13] = (uint8_t)(value >> 16);
+  counter[14] = (uint8_t)(value >> 8);
+  counter[15] = (uint8_t)value;
+}
+
+class SoftwareAesCtr : public AesCtrCipher {
+public:
+  SoftwareAesCtr() : cipher(NULL) {}
+
+  // Nothing to set up; present so the backends are interchangeable
+  void begin() {}
+
+  bool setKey(const uint8_t *key, size_t length) {
+    clear();
+    switch (length) {
+      case 16: cipher = &aes128; break;
+      case 24: cipher = &aes192; break;
+      case 32: cipher = &aes256; break;
+      default: return false;
+    }
+    return cipher->setKey(key, length);
+  }
+
+  void crypt(const uint8_t *counter, const uint8_t *in, uint8_t *out, size_t length) {
+    uint8_t block[AES_BLOCK_SIZE];
+    uint8_t keystream[AES_BLOCK_SIZE];
+    memcpy(block, counter, AES_BLOCK_SIZE);
+    while (length > 0) {
+      cipher->encryptBlock(keystream, block);
+      aesCtrIncrement(block);
+      size_t n = length < AES_BLOCK_SIZE ? length : AES_BLOCK_SIZE;
+      for (size_t i = 0; i < n; i++) {
+        out[i] = in[i] ^ keystream[i];
+      }
+      in += n;
+      out += n;
+      length -= n;
+    }
+    clean(keystream, sizeof(keystream));
+  }
+
+  void clear() {
+    aes128.clear();
+    aes192.clear();
+    aes256.clear();
+    cipher = NULL;
+  }
+
+  const char *name() const {
+    return "software AES";
+  }
+
+private:
+  AES128 aes128;
+  AES192 aes192;
+  AES256 aes256;
+  BlockCipher *cipher;
+};
+
+#if defined(__SAMD51__)
+#include "HardwareAesCtr.h"
+typedef HardwareAesCtr PlatformAesCtr;
+#else
+typedef SoftwareAesCtr PlatformAesCtr;
+#endif
+
+#endif // AES_CTR_H
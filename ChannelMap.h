@@ -0,0 +1,40 @@
+#ifndef CHANNEL_MAP_H
+#define CHANNEL_MAP_H
+
+#include <stdint.h>
+
+// Unbiased reduction of 32-bit pseudorandom words onto a channel set.
+//
+// Uses Lemire's multiply-shift method: the channel is the high word of
+// x * channelCount, and the few products whose low word falls below
+// 2^32 mod channelCount are rejected so every channel is hit by exactly
+// the same number of inputs. The rejection threshold is computed once in
+// the constructor, so reduce() does no division.
+
+class ChannelMap {
+public:
+  // channelCount must be at least 1
+  explicit ChannelMap(uint32_t channelCount)
+    : count(channelCount), threshold((uint32_t)(0 - channelCount) % channelCount) {}
+
+  uint32_t size() const {
+    return count;
+  }
+
+  // Maps x to a channel in [0, size()). Returns false if x must be rejected,
+  // in which case the caller draws another word and tries again.
+  bool reduce(uint32_t x, uint32_t *channel) const {
+    uint64_t m = (uint64_t)x * count;
+    if ((uint32_t)m < threshold) {
+      return false;
+    }
+    *channel = (uint32_t)(m >> 32);
+    return true;
+  }
+
+private:
+  uint32_t count;
+  uint32_t threshold;
+};
+
+#endif // CHANNEL_MAP_H
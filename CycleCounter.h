@@ -0,0 +1,20 @@
+#ifndef CYCLE_COUNTER_H
+#define CYCLE_COUNTER_H
+
+#include <Arduino.h>
+
+// Cortex-M4 DWT cycle counter, used by the benchmark sketches.
+// CYCCNT is 32 bits wide and wraps after about 35 seconds at 120 MHz,
+// so keep each measured section well below that.
+
+inline void cycleCounterBegin() {
+  CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+  DWT->CYCCNT = 0;
+  DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+}
+
+inline uint32_t cycleCount() {
+  return DWT->CYCCNT;
+}
+
+#endif // CYCLE_COUNTER_H
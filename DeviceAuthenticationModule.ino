@@ -1,44 +1,111 @@
-#include <SHA256.h>
+#include "KeyHierarchy.h"
+#include "PacketAuthenticator.h"
+#include "ReplayWindow.h"
 
-#define SECRET_KEY "ThisIsASecretKey" // The secret key shared between sender and receiver
+// Example master TRANSEC key shared between sender and receiver; in a
+// deployment it comes from the key fill. The MAC key is derived from it.
+const uint8_t TRANSEC_MASTER_KEY[MASTER_KEY_LENGTH] = {
+  0x3A, 0x91, 0x5C, 0x07, 0xE2, 0x4F, 0xB8, 0x16, 0x6D, 0xC3, 0x29, 0x80, 0xF5, 0x1B, 0x74, 0xAE,
+  0x02, 0x9D, 0x63, 0xC8, 0x3F, 0xE1, 0x57, 0xBA, 0x48, 0x0C, 0xD6, 0x71, 0x25, 0x9F, 0xEB, 0x34
+};
 
-SHA256 sha256;
+#define KEY_EPOCH 0 // Current key epoch, advanced at each rekey
+#define NUM_LINKS 4
+#define MAX_PACKET_SIZE 64 // Change according to your RF module
+#define LINK_HEADER_SIZE 5 // link id, sequence number
+#define REPLAY_WINDOW_BITS 256 // 64 to 1024; wider tolerates more reordering
+
+// Tag length per link: short tags for 32-byte chunks, longer ones where
+// the link has room
+const uint8_t LINK_TAG_LENGTHS[NUM_LINKS] = {4, 8, 12, 16};
+
+PacketAuthenticator linkAuthenticators[NUM_LINKS];
+uint32_t linkSequences[NUM_LINKS]; // next sequence number to send per link
+ReplayWindow<REPLAY_WINDOW_BITS> linkReplayWindows[NUM_LINKS];
+KeyHierarchy keyHierarchy;
 
 void setup() {
     // Begin serial communication
     Serial.begin(9600);
+
+    keyHierarchy.begin(TRANSEC_MASTER_KEY);
+
+    // MAC key for this epoch; its ipad/opad states are hashed once here
+    // and reused for every message until the next rekey
+    for (int link = 0; link < NUM_LINKS; link++) {
+        linkAuthenticators[link].begin(keyHierarchy.subkey(KEY_EPOCH, KEY_PURPOSE_MAC), SUBKEY_LENGTH,
+                                       LINK_TAG_LENGTHS[link]);
+    }
 }
 
 void loop() {
     // Example message to be authenticated
-    char message[] = "This is the message to be authenticated";
-
-    // Generate HMAC
-    byte hmac[SHA256::HASH_SIZE];
-    generateHMAC(SECRET_KEY, message, hmac);
+    const char message[] = "Message to authenticate";
+    const uint8_t link = 0;
 
-    // Now, hmac contains the HMAC. Send this along with your message.
+    // Packet: [link id] [sequence (4)] [message] [tag]. The link id is
+    // authenticated, so a tag cannot be moved to a link that truncates it
+    // further; the sequence number lets the receiver drop replays.
+    byte packet[MAX_PACKET_SIZE];
+    size_t packetLength = buildPacket(link, message, packet);
 
-    // In the receiver end, the receiver should compute the HMAC using the same secret key,
-    // and compare it with the received HMAC. If they match, the message is authentic.
+    // Now, send the packet. The receiver looks up the link from the first
+    // byte, drops replays by sequence number and checks the tag at the end.
 
     // Let's simulate that here:
-    byte recomputedHmac[SHA256::HASH_SIZE];
-    generateHMAC(SECRET_KEY, message, recomputedHmac);
-
-    if (memcmp(hmac, recomputedHmac, SHA256::HASH_SIZE) == 0) {
+    if (packetLength > 0 && receivePacket(packet, packetLength) >= 0) {
         Serial.println("Message is authentic");
     } else {
         Serial.println("Message is NOT authentic");
     }
 
+    // A replayed copy is dropped before the MAC is computed
+    if (packetLength > 0 && receivePacket(packet, packetLength) < 0) {
+        const ReplayStats &stats = linkReplayWindows[link].statistics();
+        Serial.println("Replay dropped (" + String(stats.accepted) + " accepted, " +
+                       String(stats.duplicates) + " duplicate, " + String(stats.tooOld) +
+                       " too old)");
+    }
+
     // Pause for a while before the next authentication
     delay(5000);
 }
 
-void generateHMAC(const char *key, const char *message, byte *hmac) {
-    // Generate the HMAC
-    sha256.initHmac((const byte *)key, strlen(key));
-    sha256.print(message);
-    sha256.resultHmac(hmac);
+// Returns the packet length, or 0 if the message does not fit
+size_t buildPacket(uint8_t link, const char *message, byte *packet) {
+    size_t messageLength = strlen(message);
+    PacketAuthenticator &authenticator = linkAuthenticators[link];
+    if (LINK_HEADER_SIZE + messageLength + authenticator.tagSize() > MAX_PACKET_SIZE) {
+        return 0;
+    }
+    uint32_t sequence = linkSequences[link]++;
+    packet[0] = link;
+    packet[1] = (uint8_t)(sequence >> 24);
+    packet[2] = (uint8_t)(sequence >> 16);
+    packet[3] = (uint8_t)(sequence >> 8);
+    packet[4] = (uint8_t)sequence;
+    memcpy(packet + LINK_HEADER_SIZE, message, messageLength);
+    return authenticator.seal(packet, LINK_HEADER_SIZE + messageLength);
+}
+
+// Returns the message length (the message starts at packet +
+// LINK_HEADER_SIZE), or -1 if the packet is a replay or not authentic
+int receivePacket(const byte *packet, size_t packetLength) {
+    if (packetLength < LINK_HEADER_SIZE || packet[0] >= NUM_LINKS) {
+        return -1;
+    }
+    uint8_t link = packet[0];
+    uint32_t sequence = ((uint32_t)packet[1] << 24) | ((uint32_t)packet[2] << 16) |
+                        ((uint32_t)packet[3] << 8) | packet[4];
+    // Replays are dropped here, before any MAC work
+    if (!linkReplayWindows[link].check(sequence)) {
+        return -1;
+    }
+    int authenticatedLength = linkAuthenticators[link].open(packet, packetLength);
+    if (authenticatedLength < 0) {
+        return -1;
+    }
+    // Only authentic packets move the window
+    linkReplayWindows[link].accept(sequence);
+    return authenticatedLength - LINK_HEADER_SIZE;
 }
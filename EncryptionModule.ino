@@ -1,38 +1,96 @@
-#include <AESLib.h>
+#include "AesCtr.h"
+#include "ImplicitNonce.h"
+#include "KeyHierarchy.h"
+#include "PacketProtector.h"
+#include "ReplayWindow.h"
 
-AESLib aesLib;
+PlatformAesCtr aes; // SAMD51 AES peripheral; software AES on other boards
+PacketProtector protector(aes);
+KeyHierarchy keyHierarchy;
 
-#define AES_KEY "ThisIsAESKey128bit" // Replace this with the key agreed upon between sender and receiver
+// Example master TRANSEC key; in a deployment it comes from the key fill.
+// The traffic key is derived from it per epoch instead of being hardcoded.
+const uint8_t TRANSEC_MASTER_KEY[MASTER_KEY_LENGTH] = {
+  0x3A, 0x91, 0x5C, 0x07, 0xE2, 0x4F, 0xB8, 0x16, 0x6D, 0xC3, 0x29, 0x80, 0xF5, 0x1B, 0x74, 0xAE,
+  0x02, 0x9D, 0x63, 0xC8, 0x3F, 0xE1, 0x57, 0xBA, 0x48, 0x0C, 0xD6, 0x71, 0x25, 0x9F, 0xEB, 0x34
+};
+
+#define KEY_EPOCH 0 // Current key epoch, advanced at each rekey
+#define AES_KEY_BITS 128
 
 #define DATA_SIZE 128 // Change according to your data size requirements
-#define BLOCK_SIZE 16 // AES block size is 16 bytes
+#define LINK_ID 1
+#define HEADER_SIZE (2 + PACKET_NONCE_HEADER_BYTES) // address, flags, hop check, sequence
+#define REPLAY_WINDOW_BITS 128
+#define HOP_INTERVAL 500 // ms; stands in for the hopping system's hop clock
 
-byte iv[BLOCK_SIZE]; // Initialization vector - random for each encryption and sent with the cipher
+// Nonces are built from the epoch, hop, link, direction and sequence
+// number, so only the hop check and per-hop sequence bytes go on the air
+// with the packet
+ImplicitNonce senderNonces(LINK_ID, PACKET_DIRECTION_OUT);
+ImplicitNonce receiverNonces(LINK_ID, PACKET_DIRECTION_OUT);
+// Sequence numbers restart every hop, so the receiver's window is keyed on
+// (hop, sequence) and drops packets from earlier hops before decrypting
+HopReplayWindow<REPLAY_WINDOW_BITS> replayWindow;
+uint64_t currentHop = 0;
+uint32_t hopStartMillis = 0;
 
 void setup() {
     // Begin serial communication
     Serial.begin(9600);
-    // Initialize AES key
-    aesLib.gen_iv(iv);
+    // Initialize key hierarchy and the cipher
+    keyHierarchy.begin(TRANSEC_MASTER_KEY);
+    aes.begin();
+    senderNonces.setEpoch(KEY_EPOCH);
+    receiverNonces.setEpoch(KEY_EPOCH);
+    replayWindow.reset();
+
+    // Traffic key for this epoch; the cipher keeps its schedule (or the
+    // peripheral keeps the key) until the next rekey
+    protector.setKey(keyHierarchy.subkey(KEY_EPOCH, KEY_PURPOSE_TRAFFIC), AES_KEY_BITS / 8);
 }
 
 void loop() {
-    // Example plaintext to be encrypted
-    char data[DATA_SIZE] = "This is the plain text message that needs to be encrypted!";
+    // Count hops from the time since start (safe across millis() wrapping);
+    // with the hopping system the hop index comes from the hop scheduler
+    while (millis() - hopStartMillis >= HOP_INTERVAL) {
+        hopStartMillis += HOP_INTERVAL;
+        currentHop++;
+    }
+
+    // Example packet: header, plaintext to be encrypted, room for the tag
+    byte packet[HEADER_SIZE + DATA_SIZE + PACKET_TAG_SIZE] = {0x01, 0x02};
+    char *data = (char *)packet + HEADER_SIZE;
+    strcpy(data, "This is the plain text message that needs to be encrypted!");
 
-    // Encrypt data
-    int cipherLength = aesLib.get_cipher_length(sizeof(data));
-    char cipher[cipherLength];
-    aesLib.encrypt((byte *)data, sizeof(data), cipher, AES_KEY, sizeof(AES_KEY), iv);
+    // A nonce never repeats under one key: the sequence number only counts
+    // up within a hop, and a full hop has to wait for the next one
+    byte nonce[PACKET_NONCE_SIZE];
+    if (!senderNonces.next(currentHop, nonce, packet + 2)) {
+        Serial.println("No sequence numbers left in this hop; packet not sent");
+        delay(HOP_INTERVAL);
+        return;
+    }
 
-    // Send encrypted data (cipher) using your communication protocol
+    // Encrypt and authenticate in one pass, in place; the header is
+    // authenticated but stays readable
+    protector.protect(nonce, packet, HEADER_SIZE, DATA_SIZE);
 
-    // For testing purposes, let's decrypt the data back to plaintext
-    char decryptedData[DATA_SIZE];
-    aesLib.decrypt((byte *)cipher, cipherLength, decryptedData, AES_KEY, sizeof(AES_KEY), iv);
+    // Send the packet using your communication protocol
 
-    // Print decrypted data to serial
-    Serial.println(decryptedData);
+    // For testing purposes, let's check and decrypt it back to plaintext,
+    // rebuilding the nonce the way the receiver does
+    byte receivedNonce[PACKET_NONCE_SIZE];
+    uint32_t sequence;
+    if (!receiverNonces.expand(currentHop, packet + 2, receivedNonce, &sequence) ||
+        !replayWindow.check(currentHop, sequence)) {
+        Serial.println("Packet is a replay"); // dropped without decrypting
+    } else if (protector.unprotect(receivedNonce, packet, HEADER_SIZE, DATA_SIZE)) {
+        replayWindow.accept(currentHop, sequence);
+        Serial.println(data);
+    } else {
+        Serial.println("Packet is NOT authentic");
+    }
 
     // Implement your communication logic to send/receive encrypted data
 
@@ -0,0 +1,209 @@
+#ifndef ENTROPY_POOL_H
+#define ENTROPY_POOL_H
+
+#include <Arduino.h>
+#include <SHA256.h>
+#include <Crypto.h>
+#include "TrngHealthTest.h"
+
+// Interrupt-driven SAMD51 TRNG entropy pool feeding an HMAC_DRBG.
+//
+// The TRNG DATARDY interrupt stores whole 32-bit words into a raw pool in the
+// background. When the pool is full the interrupt is switched off, and
+// service() (called from loop()) conditions the pool with SHA-256 and seeds
+// or reseeds an SP 800-90A HMAC_DRBG (SHA-256). randomBytes() never waits on
+// the TRNG: it returns false until the first seed is in place, and after that
+// produces output from the DRBG. Collection restarts automatically when a
+// reseed is due.
+//
+// Every word passes the SP 800-90B health tests in TrngHealthTest.h as it
+// arrives. An alarm stops collection, the pool is discarded, and
+// randomBytes() refuses all further requests, so no key is ever generated
+// from a failing TRNG.
+//
+// The sketch must forward the interrupt:
+//   void TRNG_Handler() { entropyPool.handleInterrupt(); }
+
+#define ENTROPY_POOL_WORDS 64              // 256 bytes of raw TRNG output per seed
+#define ENTROPY_RESEED_INTERVAL 1024       // DRBG generate calls between reseeds
+#define DRBG_OUTLEN SHA256::HASH_SIZE
+
+// SP 800-90A HMAC_DRBG with SHA-256
+class HmacDrbg {
+public:
+  HmacDrbg() : reseedCounter(0), instantiated(false) {}
+
+  void instantiate(const uint8_t *entropy, size_t entropyLength,
+                   const uint8_t *nonce, size_t nonceLength) {
+    memset(key, 0x00, sizeof(key));
+    memset(value, 0x01, sizeof(value));
+    update(entropy, entropyLength, nonce, nonceLength);
+    reseedCounter = 1;
+    instantiated = true;
+  }
+
+  void reseed(const uint8_t *entropy, size_t entropyLength) {
+    update(entropy, entropyLength, NULL, 0);
+    reseedCounter = 1;
+  }
+
+  void generate(uint8_t *output, size_t length) {
+    while (length > 0) {
+      hmac(value, value, sizeof(value), NULL, 0, NULL, 0);
+      size_t n = length < sizeof(value) ? length : sizeof(value);
+      memcpy(output, value, n);
+      output += n;
+      length -= n;
+    }
+    update(NULL, 0, NULL, 0);
+    reseedCounter++;
+  }
+
+  bool isInstantiated() const {
+    return instantiated;
+  }
+
+  uint32_t generateCount() const {
+    return reseedCounter;
+  }
+
+  void clear() {
+    clean(key, sizeof(key));
+    clean(value, sizeof(value));
+    instantiated = false;
+  }
+
+private:
+  // HMAC_DRBG_Update with the provided data given in two parts
+  void update(const uint8_t *data1, size_t length1, const uint8_t *data2, size_t length2) {
+    uint8_t separator = 0x00;
+    hmac(key, value, sizeof(value), &separator, 1, data1, length1, data2, length2);
+    hmac(value, value, sizeof(value), NULL, 0, NULL, 0);
+    if (length1 + length2 == 0) {
+      return;
+    }
+    separator = 0x01;
+    hmac(key, value, sizeof(value), &separator, 1, data1, length1, data2, length2);
+    hmac(value, value, sizeof(value), NULL, 0, NULL, 0);
+  }
+
+  // output = HMAC(key, a || b || c || d)
+  void hmac(uint8_t *output, const uint8_t *a, size_t aLength, const uint8_t *b, size_t bLength,
+            const uint8_t *c, size_t cLength, const uint8_t *d = NULL, size_t dLength = 0) {
+    uint8_t result[DRBG_OUTLEN];
+    sha256.resetHMAC(key, sizeof(key));
+    sha256.update(a, aLength);
+    sha256.update(b, bLength);
+    sha256.update(c, cLength);
+    sha256.update(d, dLength);
+    sha256.finalizeHMAC(key, sizeof(key), result, sizeof(result));
+    memcpy(output, result, sizeof(result));
+    clean(result, sizeof(result));
+  }
+
+  SHA256 sha256;
+  uint8_t key[DRBG_OUTLEN];
+  uint8_t value[DRBG_OUTLEN];
+  uint32_t reseedCounter;
+  bool instantiated;
+};
+
+class EntropyPool {
+public:
+  EntropyPool() : rawCount(0), collecting(false) {}
+
+  void begin() {
+    MCLK->APBCMASK.bit.TRNG_ = 1;  // enable clock
+    TRNG->CTRLA.bit.ENABLE = 1;    // enable the TRNG
+    NVIC_EnableIRQ(TRNG_IRQn);
+    startCollecting();
+  }
+
+  // Condition a full pool into the DRBG. Call from loop(); cheap when idle.
+  void service() {
+    if (health.failed()) {
+      clean((void *)rawWords, sizeof(rawWords));
+      drbg.clear();
+      return;
+    }
+    if (collecting || rawCount < ENTROPY_POOL_WORDS) {
+      return;
+    }
+    uint8_t seed[DRBG_OUTLEN];
+    uint8_t nonce[DRBG_OUTLEN];
+    condition(0x00, seed);
+    condition(0x01, nonce);
+    clean((void *)rawWords, sizeof(rawWords));
+    rawCount = 0;
+
+    if (drbg.isInstantiated()) {
+      drbg.reseed(seed, sizeof(seed));
+    } else {
+      drbg.instantiate(seed, sizeof(seed), nonce, sizeof(nonce) / 2);
+    }
+    clean(seed, sizeof(seed));
+    clean(nonce, sizeof(nonce));
+  }
+
+  // Non-blocking: fills buffer and returns true once the DRBG has been
+  // seeded, otherwise returns false and leaves buffer untouched.
+  bool randomBytes(uint8_t *buffer, size_t length) {
+    service();
+    if (health.failed() || !drbg.isInstantiated()) {
+      return false;
+    }
+    drbg.generate(buffer, length);
+    if (drbg.generateCount() >= ENTROPY_RESEED_INTERVAL && !collecting && rawCount == 0) {
+      startCollecting();
+    }
+    return true;
+  }
+
+  bool isSeeded() const {
+    return drbg.isInstantiated();
+  }
+
+  // True once a TRNG health test has failed; key generation is stopped
+  bool healthAlarm() const {
+    return health.failed();
+  }
+
+  void handleInterrupt() {
+    uint32_t word = TRNG->DATA.reg; // reading DATA clears DATARDY
+    if (!health.addWord(word)) {
+      TRNG->INTENCLR.reg = TRNG_INTENCLR_DATARDY;
+      collecting = false;
+      return;
+    }
+    if (rawCount < ENTROPY_POOL_WORDS) {
+      rawWords[rawCount++] = word;
+    }
+    if (rawCount == ENTROPY_POOL_WORDS) {
+      TRNG->INTENCLR.reg = TRNG_INTENCLR_DATARDY;
+      collecting = false;
+    }
+  }
+
+private:
+  void startCollecting() {
+    collecting = true;
+    TRNG->INTENSET.reg = TRNG_INTENSET_DATARDY;
+  }
+
+  // SHA-256(label || raw pool)
+  void condition(uint8_t label, uint8_t *output) {
+    conditioner.reset();
+    conditioner.update(&label, 1);
+    conditioner.update((const void *)rawWords, sizeof(rawWords));
+    conditioner.finalize(output, DRBG_OUTLEN);
+  }
+
+  volatile uint32_t rawWords[ENTROPY_POOL_WORDS];
+  volatile uint16_t rawCount;
+  volatile bool collecting;
+  TrngHealthTest health;
+  SHA256 conditioner;
+  HmacDrbg drbg;
+};
+
+#endif // ENTROPY_POOL_H
@@ -1,64 +1,310 @@
 #include <SPI.h>
+#include "HopScheduler.h"
+#include "EntropyPool.h"
+#include "TransecKeyRing.h"
+#include "Otar.h"
 
 #define KEY_LENGTH 32
-#define NUMBER_OF_FREQUENCIES 10
+#define NUMBER_OF_CHANNELS 100
 #define HOP_INTERVAL 500 // Frequency hopping interval in milliseconds
+#define JITTER_REPORT_HOPS 100 // Print the hop jitter histogram this often
+
+// Permutation hopping visits every channel exactly once per epoch of
+// NUMBER_OF_CHANNELS hops. Set to 0 for independent pseudorandom hops.
+#define USE_PERMUTATION_HOPPING 1
+
+#define KEY_EPOCH 0 // Epoch of the first key, advanced at each rekey
+#define KEY_ROLLOVER_LEAD_HOPS 20 // Default hops between setkey and the switchover
 
 uint8_t TRANSECKey[KEY_LENGTH];
-uint8_t frequencyHoppingPattern[NUMBER_OF_FREQUENCIES];
 
-unsigned long lastHopTime = 0;
-int currentFrequencyIndex = 0;
+uint64_t reportedHopIndex = 0;
+uint64_t keyEpoch = KEY_EPOCH;
+
+Tc2HopTimer hopTimer;
+HopScheduler hopScheduler(hopTimer);
+EntropyPool entropyPool;
+TransecKeyRing keyRing(NUMBER_OF_CHANNELS, USE_PERMUTATION_HOPPING);
+OtarSender otarSender;
+OtarReceiver otarReceiver;
+uint8_t otarAck[OTAR_ACK_SIZE];
+size_t otarAckLength = 0; // latest ack, sent in the next free slot
+
+// OTAR outcomes seen by receivePacket(), which may run in the radio
+// driver's context, reported on Serial from loop()
+enum OtarEvent {
+  OTAR_EVENT_NONE,
+  OTAR_EVENT_ACKED,
+  OTAR_EVENT_KEY_SCHEDULED,
+  OTAR_EVENT_KEY_REJECTED
+};
+volatile OtarEvent otarEvent = OTAR_EVENT_NONE;
+volatile uint64_t otarEventHop = 0;
 
 void setup() {
   Serial.begin(115200);
   while (!Serial); // wait for serial port to connect
+  Serial.setTimeout(10); // a partial command line must not stall hop staging
 
-  // Initialize TRNG
-  MCLK->APBCMASK.bit.TRNG_ = 1;  // enable clock
-  TRNG->CTRLA.bit.ENABLE = 1;    // enable the TRNG
+  // Start collecting TRNG output in the background
+  entropyPool.begin();
 
   // Generate TRANSEC key
-  generateTRANSECKey();
-
-  // Initialize frequency hopping pattern
-  for (int i = 0; i < NUMBER_OF_FREQUENCIES; i++) {
-    frequencyHoppingPattern[i] = TRANSECKey[i % KEY_LENGTH] % 100; // for example purpose
+  if (!generateTRANSECKey()) {
+    Serial.println("TRNG health test failed, no TRANSEC key generated.");
+    while (true);
   }
 
+  // Key the frequency hopping pattern with the epoch's hop subkey;
+  // hops are computed on demand
+  keyRing.begin(TRANSECKey, keyEpoch);
+  clean(TRANSECKey, sizeof(TRANSECKey));
+
   // Initialize SPI communication
   SPI.begin();
 
-  // Start at the first frequency
-  hopFrequency();
+  // Start at the first frequency; the timer interrupt takes over from here
+  hopScheduler.begin(HOP_INTERVAL * 1000UL, setFrequency);
+  hopScheduler.start(0, channelForHop(0));
 }
 
 void loop() {
-  // Check if it's time to hop to the next frequency
-  if (millis() - lastHopTime > HOP_INTERVAL) {
-    hopFrequency();
+  // Compute the next hop's channel during the current dwell so the timer
+  // interrupt only has to commit it
+  uint64_t nextHopIndex;
+  if (hopScheduler.needsStaging(&nextHopIndex)) {
+    hopScheduler.stage(nextHopIndex, channelForHop(nextHopIndex));
+  }
+
+  // Derive a pending key a step at a time, and retire the old key once
+  // the switchover hop has been reached
+  keyRing.prepare();
+  uint64_t hopIndex = hopScheduler.currentHop();
+  keyRing.advance(hopIndex);
+
+  // Over-the-air rekey fragments and acks only use slots the data traffic
+  // leaves free
+  if (linkIdle()) {
+    uint8_t packet[OTAR_PACKET_SIZE];
+    size_t length;
+    if (otarAckLength > 0) {
+      transmitPacket(otarAck, otarAckLength);
+      otarAckLength = 0;
+    } else if ((length = otarSender.nextPacket(packet, millis())) > 0) {
+      transmitPacket(packet, length);
+    }
+  }
+  if (otarSender.failed()) {
+    otarSender.cancel();
+    Serial.println("OTAR not acknowledged; the new key still takes effect here.");
+  }
+  reportOtarEvent();
+
+  if (Serial.available()) {
+    handleCommand(Serial.readStringUntil('\n'));
+  }
+
+  if (hopIndex != reportedHopIndex) {
+    reportedHopIndex = hopIndex;
+    Serial.println("Hopping to frequency: " + String(hopScheduler.currentChannel()));
+    if (hopIndex % JITTER_REPORT_HOPS == 0) {
+      printHopJitter();
+    }
+  }
+}
+
+void TC2_Handler() {
+  hopScheduler.handleInterrupt();
+}
+
+// Returns false if the TRNG failed its health tests
+bool generateTRANSECKey() {
+  // Only waits for the first pool fill; after that this returns at once
+  while (!entropyPool.randomBytes(TRANSECKey, KEY_LENGTH)) {
+    if (entropyPool.healthAlarm()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void TRNG_Handler() {
+  entropyPool.handleInterrupt();
+}
+
+uint8_t channelForHop(uint64_t hopIndex) {
+  return keyRing.channel(hopIndex);
+}
+
+// setkey <64 hex digits> [hop]: switch to a new master key at the given hop
+// (default KEY_ROLLOVER_LEAD_HOPS from now). Every node must be given the
+// same key and hop; the running sequence is not interrupted.
+// otar <64 hex digits> [hop]: as setkey, and also send the key over the air
+// to the other nodes, wrapped under the current epoch's key.
+void handleCommand(String command) {
+  command.trim();
+  bool overTheAir = command.startsWith("otar ");
+  if (!overTheAir && !command.startsWith("setkey ")) {
+    Serial.println("Unknown command.");
+    return;
+  }
+
+  String args = command.substring(overTheAir ? 5 : 7);
+  args.trim();
+  int space = args.indexOf(' ');
+  String keyHex = space < 0 ? args : args.substring(0, space);
+  uint64_t activationHop = hopScheduler.currentHop() + KEY_ROLLOVER_LEAD_HOPS;
+  if (space >= 0 && !parseHopIndex(args.substring(space + 1), &activationHop)) {
+    Serial.println("Activation hop must be an unsigned decimal number.");
+    return;
   }
+
+  uint8_t newKey[KEY_LENGTH];
+  if (!parseHexKey(keyHex, newKey)) {
+    Serial.println("Key must be " + String(KEY_LENGTH * 2) + " hex digits.");
+    return;
+  }
+  // The next hop may already be staged under the current key
+  if (activationHop <= hopScheduler.currentHop() + 1) {
+    Serial.println("Activation hop must be at least two hops ahead.");
+  } else if (overTheAir && otarSender.sending()) {
+    Serial.println("An over-the-air rekey is already in progress.");
+  } else if (!keyRing.scheduleNext(newKey, keyEpoch + 1, activationHop)) {
+    Serial.println("A key rollover is already pending.");
+  } else {
+    if (overTheAir) {
+      uint64_t hop = hopScheduler.currentHop();
+      otarSender.begin(keyRing.subkey(hop, KEY_PURPOSE_KEY_WRAP),
+                       keyRing.subkey(hop, KEY_PURPOSE_OTAR_AUTH), newKey, keyEpoch + 1,
+                       activationHop);
+    }
+    keyEpoch++;
+    Serial.println("New TRANSEC key takes effect at hop " + String((unsigned long)activationHop));
+  }
+  clean(newKey, sizeof(newKey));
 }
 
-void generateTRANSECKey() {
-  for (int i = 0; i < KEY_LENGTH; i++) {
-    TRANSECKey[i] = get_trng() & 0xFF;
+// Called by the radio driver for each link packet received. OTAR packets
+// carry a tag under the current epoch's OTAR subkey; anything else, or a
+// packet that fails the tag, is data. Results are reported from loop().
+void receivePacket(const uint8_t *packet, size_t length) {
+  uint64_t hop = hopScheduler.currentHop();
+  if (otarSender.handlePacket(packet, length)) {
+    if (otarSender.finished()) {
+      otarEvent = OTAR_EVENT_ACKED;
+    }
+    return;
+  }
+
+  // A wrapped next-epoch key fragment: ack it and schedule the key once
+  // complete. A newer ack replaces one still waiting for a slot.
+  size_t ackLength = otarReceiver.handlePacket(packet, length,
+                                               keyRing.subkey(hop, KEY_PURPOSE_KEY_WRAP),
+                                               keyRing.subkey(hop, KEY_PURPOSE_OTAR_AUTH), otarAck);
+  if (ackLength == 0) {
+    // Data traffic goes to the demultiplexer here
+    return;
+  }
+  otarAckLength = ackLength;
+
+  uint8_t newKey[KEY_LENGTH];
+  uint64_t epoch, activationHop;
+  if (otarReceiver.takeKey(newKey, &epoch, &activationHop)) {
+    if (epoch != keyEpoch + 1 || activationHop <= hop + 1 ||
+        !keyRing.scheduleNext(newKey, epoch, activationHop)) {
+      otarEvent = OTAR_EVENT_KEY_REJECTED;
+    } else {
+      keyEpoch = epoch;
+      otarEventHop = activationHop;
+      otarEvent = OTAR_EVENT_KEY_SCHEDULED;
+    }
+    clean(newKey, sizeof(newKey));
   }
 }
 
-uint32_t get_trng() {
-  while ((TRNG->INTFLAG.reg & TRNG_INTFLAG_MASK) == 0);
-  return (TRNG->DATA.reg);
+void reportOtarEvent() {
+  noInterrupts();
+  OtarEvent event = otarEvent;
+  uint64_t hop = otarEventHop;
+  otarEvent = OTAR_EVENT_NONE;
+  interrupts();
+  if (event == OTAR_EVENT_ACKED) {
+    Serial.println("OTAR acknowledged.");
+  } else if (event == OTAR_EVENT_KEY_SCHEDULED) {
+    Serial.println("OTAR key takes effect at hop " + String((unsigned long)hop));
+  } else if (event == OTAR_EVENT_KEY_REJECTED) {
+    Serial.println("OTAR key rejected: wrong epoch, too late or a rollover is pending.");
+  }
 }
 
-void hopFrequency() {
-  currentFrequencyIndex = (currentFrequencyIndex + 1) % NUMBER_OF_FREQUENCIES;
-  setFrequency(frequencyHoppingPattern[currentFrequencyIndex]);
-  lastHopTime = millis();
+bool parseHexKey(const String &hex, uint8_t *key) {
+  if (hex.length() != KEY_LENGTH * 2) {
+    return false;
+  }
+  for (int i = 0; i < KEY_LENGTH * 2; i++) {
+    char c = hex.charAt(i);
+    uint8_t nibble;
+    if (c >= '0' && c <= '9') {
+      nibble = c - '0';
+    } else if (c >= 'a' && c <= 'f') {
+      nibble = c - 'a' + 10;
+    } else if (c >= 'A' && c <= 'F') {
+      nibble = c - 'A' + 10;
+    } else {
+      return false;
+    }
+    key[i / 2] = (i & 1) ? (key[i / 2] | nibble) : (nibble << 4);
+  }
+  return true;
 }
 
-void setFrequency(uint8_t frequency) {
+// Digits only: no sign, spaces or suffix, and nothing that overflows 64 bits
+bool parseHopIndex(const String &decimal, uint64_t *hop) {
+  if (decimal.length() == 0) {
+    return false;
+  }
+  uint64_t value = 0;
+  for (unsigned int i = 0; i < decimal.length(); i++) {
+    char c = decimal.charAt(i);
+    if (c < '0' || c > '9' || value > (UINT64_MAX - (c - '0')) / 10) {
+      return false;
+    }
+    value = value * 10 + (c - '0');
+  }
+  *hop = value;
+  return true;
+}
+
+// Called from the hop timer interrupt: keep it short and do not print here.
+void setFrequency(uint32_t frequency) {
   // Code to change to the given frequency should be implemented here.
-  // For this example, let's just print it to the Serial Monitor
-  Serial.println("Hopping to frequency: " + String(frequency));
+  // The new frequency is printed from loop() once the hop has been committed.
+}
+
+bool linkIdle() {
+  // Return false while the radio has data traffic queued or is transmitting
+  return true;
+}
+
+void transmitPacket(const uint8_t *packet, size_t length) {
+  // Code to queue the packet on the radio should be implemented here.
+}
+
+void printHopJitter() {
+  uint32_t bins[HOP_JITTER_BINS];
+  uint32_t maxLateMicros;
+  hopScheduler.jitterHistogram(bins, &maxLateMicros);
+
+  Serial.println("Hop commit lateness (us: hops):");
+  for (int i = 0; i < HOP_JITTER_BINS; i++) {
+    if (bins[i] == 0) {
+      continue;
+    }
+    Serial.print("  ");
+    Serial.print(i);
+    Serial.print(i == HOP_JITTER_BINS - 1 ? "+: " : ": ");
+    Serial.println(bins[i]);
+  }
+  Serial.println("  max: " + String(maxLateMicros) + " us, missed stages: " +
+                 String(hopScheduler.missedStageCount()));
 }
@@ -1,48 +1,82 @@
 #include <SPI.h>
+#include "HopSequence.h"
+#include "HopTimeOfDay.h"
+#include "EntropyPool.h"
 
 #define TRANSEC_KEY_LENGTH 32  // length of TRANSEC key in bytes
-#define HOPPING_PATTERN_LENGTH 100 // number of frequency hops in the pattern
+#define HOPPING_PATTERN_LENGTH 100 // number of frequency hops to display
+#define BASE_FREQUENCY 2400000000UL // Hz
+#define FREQUENCY_SPAN 100000000UL  // Hz, 1 Hz channel raster for this example
+#define HOP_DWELL_MS 500            // dwell agreed by every node in the network
+#define MISSION_ORIGIN_MS 0ULL      // time of day of hop 0, agreed with the key
+#define TOD_UNCERTAINTY_HOPS 4      // late entry listens on +/- this many hops
 
 uint8_t TRANSEC_KEY[TRANSEC_KEY_LENGTH];
-uint32_t frequencyHoppingPattern[HOPPING_PATTERN_LENGTH];
+HopSequence hopSequence; // keyed by TRANSEC_KEY, hop(n) is computed on demand
+const ChannelMap frequencyMap(FREQUENCY_SPAN);
+const HopTimeOfDay hopTimeOfDay(MISSION_ORIGIN_MS, HOP_DWELL_MS);
+EntropyPool entropyPool; // interrupt-fed TRNG pool with DRBG output
 
-// SAMD51 TRNG Initialization
-void initTRNG() {
-  MCLK->APBCMASK.bit.TRNG_ = 1;  // enable clock  (APBC clock is already enabled)
-  TRNG->CTRLA.bit.ENABLE = 1;    // enable the TRNG
-}
-
-// Get a random number using TRNG
-uint32_t getTRNG() {
-  while ((TRNG->INTFLAG.reg & TRNG_INTFLAG_MASK) == 0);  // Busy loop waiting for next RN to be created
-  return (TRNG->DATA.reg);   // return the new number.
+void TRNG_Handler() {
+  entropyPool.handleInterrupt();
 }
 
 void setup() {
   Serial.begin(9600);
   while (!Serial);  // Wait for Serial Monitor to open
-  initTRNG();  // Initialize the TRNG
+  entropyPool.begin();  // Start collecting TRNG output in the background
   
   // Assume TRANSEC_KEY is already shared and stored in both devices.
   // Here we will just simulate that by generating a random TRANSEC key
-  for (int i = 0; i < TRANSEC_KEY_LENGTH; i++) {
-    TRANSEC_KEY[i] = (uint8_t)getTRNG();
+  while (!entropyPool.randomBytes(TRANSEC_KEY, TRANSEC_KEY_LENGTH)) {
+    if (entropyPool.healthAlarm()) {
+      Serial.println("TRNG health test failed, no TRANSEC key generated.");
+      while (true);
+    }
   }
   
-  // Generate frequency hopping pattern
-  for (int i = 0; i < HOPPING_PATTERN_LENGTH; i++) {
-    // This example assumes frequency range from 2400MHz to 2500MHz for simplicity
-    frequencyHoppingPattern[i] = 2400000000 + (getTRNG() % 100000000);
-  }
+  // Key the frequency hopping sequence. Both devices holding the same
+  // TRANSEC key derive the same sequence, so no pattern table is exchanged.
+  hopSequence.begin(TRANSEC_KEY);
 
-  // Display the frequency hopping pattern
+  // Display the start of the frequency hopping pattern
   for (int i = 0; i < HOPPING_PATTERN_LENGTH; i++) {
     Serial.print("Hop ");
     Serial.print(i);
     Serial.print(": ");
-    Serial.print(frequencyHoppingPattern[i]);
+    Serial.print(hopFrequency(i));
     Serial.println(" Hz");
   }
+
+  // Late network entry example: a node joining 6 hours into the mission
+  // with a time of day only known to within a couple of seconds
+  lateEntry(MISSION_ORIGIN_MS + 6ULL * 60 * 60 * 1000);
+}
+
+// Channels to listen on when joining the network at a coarse time of day.
+// Computes the hops around the expected one directly; nothing before them
+// has to be generated and neither end has to rekey or restart.
+void lateEntry(uint64_t todMillis) {
+  HopCandidate candidates[2 * TOD_UNCERTAINTY_HOPS + 1];
+  uint64_t expectedHop = hopTimeOfDay.hopAt(todMillis);
+  uint16_t count = hopTimeOfDay.candidates(expectedHop, TOD_UNCERTAINTY_HOPS, hopFrequency, candidates);
+
+  Serial.print("Late entry candidates around hop ");
+  Serial.print((unsigned long)expectedHop);
+  Serial.println(":");
+  for (uint16_t i = 0; i < count; i++) {
+    Serial.print("  Hop ");
+    Serial.print((unsigned long)candidates[i].hopIndex);
+    Serial.print(": ");
+    Serial.print(candidates[i].channel);
+    Serial.println(" Hz");
+  }
+}
+
+// Frequency for any hop index, computed directly from the TRANSEC key
+uint32_t hopFrequency(uint64_t hopIndex) {
+  // This example assumes frequency range from 2400MHz to 2500MHz for simplicity
+  return BASE_FREQUENCY + hopSequence.channel(hopIndex, frequencyMap);
 }
 
 void loop() {
@@ -0,0 +1,173 @@
+#ifndef HARDWARE_AES_CTR_H
+#define HARDWARE_AES_CTR_H
+
+#include <Arduino.h>
+#include <Adafruit_ZeroDMA.h>
+#include "AesCtr.h"
+
+// AES-CTR on the SAMD51 AES peripheral.
+//
+// The key is written to the peripheral once in setKey() and the peripheral
+// expands it itself, so there is no schedule in RAM. crypt() loads the
+// counter block with NEWMSG set and runs the first block from the CPU;
+// after that, whole blocks are moved by two DMA channels (one feeding
+// INDATA on the write request, one draining it on the read request) when
+// the run is long enough to pay for starting them and both buffers are
+// word aligned. Shorter runs and the last partial block go through the CPU
+// one block at a time.
+//
+// The peripheral's block counter is only 16 bits wide, so crypt() starts a
+// new message before it would wrap and does the carry into the upper half
+// of the 32-bit counter itself. The peripheral has one key and one mode:
+// use one HardwareAesCtr per sketch.
+
+#define HARDWARE_AES_DMA_MIN_BYTES 64 // below this the CPU loop is faster
+
+class HardwareAesCtr : public AesCtrCipher {
+public:
+  HardwareAesCtr() : keyed(false), dmaReady(false), writeDescriptor(NULL), readDescriptor(NULL) {}
+
+  // Enable the peripheral and allocate the DMA channels. Without DMA
+  // channels every block goes through the CPU.
+  void begin() {
+    MCLK->APBCMASK.reg |= MCLK_APBCMASK_AES;
+    AES->CTRLA.reg = AES_CTRLA_SWRST;
+    while (AES->CTRLA.reg & AES_CTRLA_SWRST);
+
+    if (writeDma.allocate() == DMA_STATUS_OK && readDma.allocate() == DMA_STATUS_OK) {
+      writeDma.setTrigger(AES_DMAC_ID_WR);
+      writeDma.setAction(DMA_TRIGGER_ACTON_BEAT);
+      writeDescriptor = writeDma.addDescriptor(NULL, (void *)&AES->INDATA.reg, 4,
+                                               DMA_BEAT_SIZE_WORD, true, false);
+      readDma.setTrigger(AES_DMAC_ID_RD);
+      readDma.setAction(DMA_TRIGGER_ACTON_BEAT);
+      readDescriptor = readDma.addDescriptor((void *)&AES->INDATA.reg, NULL, 4,
+                                             DMA_BEAT_SIZE_WORD, false, true);
+      dmaReady = writeDescriptor != NULL && readDescriptor != NULL;
+    }
+  }
+
+  bool setKey(const uint8_t *key, size_t length) {
+    uint32_t keySize;
+    switch (length) {
+      case 16: keySize = AES_CTRLA_KEYSIZE_128BIT; break;
+      case 24: keySize = AES_CTRLA_KEYSIZE_192BIT; break;
+      case 32: keySize = AES_CTRLA_KEYSIZE_256BIT; break;
+      default: return false;
+    }
+    // CTRLA can only be written while the peripheral is disabled
+    AES->CTRLA.reg = 0;
+    AES->CTRLA.reg = AES_CTRLA_AESMODE_CTR | AES_CTRLA_CIPHER_ENC | keySize |
+                     AES_CTRLA_STARTMODE_AUTO;
+    AES->CTRLA.reg |= AES_CTRLA_ENABLE;
+    for (size_t i = 0; i < length / 4; i++) {
+      AES->KEYWORD[i].reg = loadWord(key + 4 * i);
+    }
+    keyed = true;
+    return true;
+  }
+
+  void crypt(const uint8_t *counter, const uint8_t *in, uint8_t *out, size_t length) {
+    uint8_t block[AES_BLOCK_SIZE];
+    memcpy(block, counter, AES_BLOCK_SIZE);
+    while (length > 0) {
+      size_t segmentBlocks = 0x10000 - (((uint32_t)block[14] << 8) | block[15]);
+      size_t segment = length;
+      if (segment > segmentBlocks * AES_BLOCK_SIZE) {
+        segment = segmentBlocks * AES_BLOCK_SIZE;
+      }
+      cryptSegment(block, in, out, segment);
+      in += segment;
+      out += segment;
+      length -= segment;
+
+      // Only reached again if the low 16 bits wrapped: carry by hand
+      block[14] = 0;
+      block[15] = 0;
+      if (++block[13] == 0) {
+        block[12]++;
+      }
+    }
+  }
+
+  void clear() {
+    // Disabling does not clear KEYWORD; overwrite it, then reset
+    if (keyed) {
+      for (int i = 0; i < 8; i++) {
+        AES->KEYWORD[i].reg = 0;
+      }
+    }
+    AES->CTRLA.reg = AES_CTRLA_SWRST;
+    while (AES->CTRLA.reg & AES_CTRLA_SWRST);
+    keyed = false;
+  }
+
+  const char *name() const {
+    return dmaReady ? "SAMD51 AES + DMA" : "SAMD51 AES";
+  }
+
+private:
+  static uint32_t loadWord(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+  }
+
+  // At most 65536 blocks from the counter block, as one message
+  void cryptSegment(const uint8_t *counter, const uint8_t *in, uint8_t *out, size_t length) {
+    for (int i = 0; i < 4; i++) {
+      AES->INTVECTV[i].reg = loadWord(counter + 4 * i);
+    }
+    AES->CTRLB.reg = AES_CTRLB_NEWMSG;
+    size_t n = length < AES_BLOCK_SIZE ? length : AES_BLOCK_SIZE;
+    cryptBlock(in, out, n);
+    AES->CTRLB.reg = 0;
+    in += n;
+    out += n;
+    length -= n;
+
+    size_t whole = length & ~(size_t)(AES_BLOCK_SIZE - 1);
+    if (dmaReady && whole >= HARDWARE_AES_DMA_MIN_BYTES && (((uintptr_t)in | (uintptr_t)out) & 3) == 0) {
+      AES->DATABUFPTR.reg = 0;
+      readDma.changeDescriptor(readDescriptor, (void *)&AES->INDATA.reg, out, whole / 4);
+      writeDma.changeDescriptor(writeDescriptor, (void *)in, (void *)&AES->INDATA.reg, whole / 4);
+      readDma.startJob();
+      writeDma.startJob();
+      while (readDma.isActive());
+      in += whole;
+      out += whole;
+      length -= whole;
+    }
+    while (length > 0) {
+      n = length < AES_BLOCK_SIZE ? length : AES_BLOCK_SIZE;
+      cryptBlock(in, out, n);
+      in += n;
+      out += n;
+      length -= n;
+    }
+  }
+
+  // One block through INDATA; a partial block is zero padded and truncated
+  void cryptBlock(const uint8_t *in, uint8_t *out, size_t length) {
+    uint32_t words[4] = {0, 0, 0, 0};
+    memcpy(words, in, length);
+    AES->DATABUFPTR.reg = 0;
+    for (int i = 0; i < 4; i++) {
+      AES->INDATA.reg = words[i];
+    }
+    while (!(AES->INTFLAG.reg & AES_INTFLAG_ENCCMP));
+    AES->DATABUFPTR.reg = 0;
+    for (int i = 0; i < 4; i++) {
+      words[i] = AES->INDATA.reg;
+    }
+    memcpy(out, words, length);
+    clean(words, sizeof(words));
+  }
+
+  bool keyed;
+  bool dmaReady;
+  Adafruit_ZeroDMA writeDma;
+  Adafruit_ZeroDMA readDma;
+  DmacDescriptor *writeDescriptor;
+  DmacDescriptor *readDescriptor;
+};
+
+#endif // HARDWARE_AES_CTR_H
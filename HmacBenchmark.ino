@@ -0,0 +1,136 @@
+#include "CycleCounter.h"
+#include "HmacContext.h"
+#include "PacketAuthenticator.h"
+
+// Messages per second for HMAC-SHA256 keyed per message, as
+// DeviceAuthenticationModule did, against the cached ipad/opad context,
+// and goodput per RF chunk for each truncated tag length.
+
+#define HMAC_RUNS 2000
+#define LINK_HEADER_SIZE 1 // link id
+#define AIR_BITRATE 250000 // example RF data rate, bits/s
+
+const size_t MESSAGE_SIZES[] = {32, 64, 128, 256};
+const size_t CHUNK_SIZES[] = {32, 64};
+const size_t TAG_LENGTHS[] = {4, 8, 12, 16, SHA256::HASH_SIZE}; // last: untruncated
+
+const uint8_t MAC_KEY[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+
+SHA256 sha256;
+HmacContext hmacContext;
+PacketAuthenticator authenticator;
+uint8_t message[256];
+volatile uint8_t sink; // keeps the compiler from discarding results
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  for (size_t i = 0; i < sizeof(message); i++) {
+    message[i] = (uint8_t)i;
+  }
+  hmacContext.setKey(MAC_KEY, sizeof(MAC_KEY));
+
+  Serial.println("HMAC-SHA256 benchmark");
+  Serial.println("  messages/s: keyed per message, cached key state, speedup");
+  for (unsigned int i = 0; i < sizeof(MESSAGE_SIZES) / sizeof(MESSAGE_SIZES[0]); i++) {
+    benchmarkHmac(MESSAGE_SIZES[i]);
+  }
+
+  Serial.println("  goodput per chunk: tag, message bytes, % of chunk, kbit/s at " +
+                 String(AIR_BITRATE / 1000) + " kbit/s, seal+open cycles");
+  for (unsigned int c = 0; c < sizeof(CHUNK_SIZES) / sizeof(CHUNK_SIZES[0]); c++) {
+    Serial.println("    " + String(CHUNK_SIZES[c]) + "-byte chunks:");
+    for (unsigned int t = 0; t < sizeof(TAG_LENGTHS) / sizeof(TAG_LENGTHS[0]); t++) {
+      benchmarkGoodput(CHUNK_SIZES[c], TAG_LENGTHS[t]);
+    }
+  }
+}
+
+void loop() {
+}
+
+void benchmarkHmac(size_t messageSize) {
+  uint8_t mac[SHA256::HASH_SIZE], cachedMac[SHA256::HASH_SIZE];
+
+  // Keyed per message: both padded key blocks are hashed every time
+  uint32_t startCycles = cycleCount();
+  for (int run = 0; run < HMAC_RUNS; run++) {
+    sha256.resetHMAC(MAC_KEY, sizeof(MAC_KEY));
+    sha256.update(message, messageSize);
+    sha256.finalizeHMAC(MAC_KEY, sizeof(MAC_KEY), mac, sizeof(mac));
+    sink = mac[0];
+  }
+  uint32_t perMessageCycles = cycleCount() - startCycles;
+
+  startCycles = cycleCount();
+  for (int run = 0; run < HMAC_RUNS; run++) {
+    hmacContext.compute(message, messageSize, cachedMac);
+    sink = cachedMac[0];
+  }
+  uint32_t cachedCycles = cycleCount() - startCycles;
+
+  float perMessageRate = (float)F_CPU * HMAC_RUNS / perMessageCycles;
+  float cachedRate = (float)F_CPU * HMAC_RUNS / cachedCycles;
+  Serial.print("    ");
+  Serial.print(messageSize);
+  Serial.print(" bytes: ");
+  Serial.print(perMessageRate, 0);
+  Serial.print(", ");
+  Serial.print(cachedRate, 0);
+  Serial.print(", ");
+  Serial.print(cachedRate / perMessageRate, 2);
+  Serial.print("x");
+  Serial.println(memcmp(mac, cachedMac, sizeof(mac)) == 0 ? "" : "  MISMATCH");
+}
+
+void benchmarkGoodput(size_t chunkSize, size_t tagLength) {
+  uint8_t packet[64];
+  int messageSize = (int)chunkSize - LINK_HEADER_SIZE - (int)tagLength;
+  uint32_t cycles = 0;
+  bool ok = true;
+
+  if (messageSize <= 0) {
+    Serial.println("      " + String(tagLength) + ": no room for a message");
+    return;
+  }
+
+  if (PacketAuthenticator::validTagLength(tagLength)) {
+    authenticator.begin(MAC_KEY, sizeof(MAC_KEY), tagLength);
+    for (int run = 0; run < HMAC_RUNS; run++) {
+      memcpy(packet, message, LINK_HEADER_SIZE + messageSize);
+      uint32_t startCycles = cycleCount();
+      size_t packetLength = authenticator.seal(packet, LINK_HEADER_SIZE + messageSize);
+      ok &= authenticator.open(packet, packetLength) == (int)(LINK_HEADER_SIZE + messageSize);
+      cycles += cycleCount() - startCycles;
+    }
+    // A flipped tag bit must be rejected
+    packet[chunkSize - 1] ^= 0x01;
+    ok &= authenticator.open(packet, chunkSize) < 0;
+  } else {
+    // Full tag, as DeviceAuthenticationModule sent before
+    for (int run = 0; run < HMAC_RUNS; run++) {
+      uint32_t startCycles = cycleCount();
+      hmacContext.compute(message, LINK_HEADER_SIZE + messageSize, packet);
+      ok &= hmacContext.verify(message, LINK_HEADER_SIZE + messageSize, packet);
+      cycles += cycleCount() - startCycles;
+    }
+  }
+
+  float fraction = (float)messageSize / chunkSize;
+  Serial.print("      ");
+  Serial.print(tagLength);
+  Serial.print(": ");
+  Serial.print(messageSize);
+  Serial.print(", ");
+  Serial.print(100.0f * fraction, 1);
+  Serial.print("%, ");
+  Serial.print(fraction * AIR_BITRATE / 1000, 1);
+  Serial.print(", ");
+  Serial.print(cycles / HMAC_RUNS);
+  Serial.println(ok ? "" : "  FAILED");
+}
@@ -0,0 +1,90 @@
+#ifndef HMAC_CONTEXT_H
+#define HMAC_CONTEXT_H
+
+#include <SHA256.h>
+#include <Crypto.h>
+
+// HMAC-SHA256 (RFC 2104) with the key schedule cached.
+//
+// HMAC hashes the key XOR ipad block before the message and the key XOR
+// opad block before the inner hash. Those two blocks depend only on the
+// key, so setKey() runs them once and keeps the resulting SHA-256 states;
+// each message then starts from a copy of them. A short message costs two
+// compression calls instead of four, and verification uses the same
+// context.
+
+#define HMAC_BLOCK_SIZE 64
+
+class HmacContext {
+public:
+  HmacContext() {}
+
+  ~HmacContext() {
+    clear();
+  }
+
+  void setKey(const uint8_t *key, size_t length) {
+    uint8_t block[HMAC_BLOCK_SIZE];
+    memset(block, 0, sizeof(block));
+    // Keys longer than a block are hashed first
+    if (length > HMAC_BLOCK_SIZE) {
+      inner.reset();
+      inner.update(key, length);
+      inner.finalize(block, SHA256::HASH_SIZE);
+    } else {
+      memcpy(block, key, length);
+    }
+    for (int i = 0; i < HMAC_BLOCK_SIZE; i++) {
+      block[i] ^= 0x36;
+    }
+    inner.reset();
+    inner.update(block, sizeof(block));
+    for (int i = 0; i < HMAC_BLOCK_SIZE; i++) {
+      block[i] ^= 0x36 ^ 0x5C;
+    }
+    outer.reset();
+    outer.update(block, sizeof(block));
+    clean(block, sizeof(block));
+  }
+
+  // Writes the first macLength bytes (at most SHA256::HASH_SIZE) of the MAC
+  void compute(const void *message, size_t length, uint8_t *mac,
+               size_t macLength = SHA256::HASH_SIZE) {
+    uint8_t innerHash[SHA256::HASH_SIZE];
+    work = inner;
+    work.update(message, length);
+    work.finalize(innerHash, sizeof(innerHash));
+    work = outer;
+    work.update(innerHash, sizeof(innerHash));
+    work.finalize(mac, macLength);
+    clean(innerHash, sizeof(innerHash));
+  }
+
+  // Recomputes the MAC and compares it in constant time. A macLength of 0
+  // (which would match anything) or over SHA256::HASH_SIZE is never
+  // authentic.
+  bool verify(const void *message, size_t length, const uint8_t *mac,
+              size_t macLength = SHA256::HASH_SIZE) {
+    if (macLength == 0 || macLength > SHA256::HASH_SIZE) {
+      return false;
+    }
+    uint8_t expected[SHA256::HASH_SIZE];
+    compute(message, length, expected, macLength);
+    bool authentic = secure_compare(expected, mac, macLength);
+    clean(expected, sizeof(expected));
+    return authentic;
+  }
+
+  void clear() {
+    inner.clear();
+    outer.clear();
+    work.clear();
+  }
+
+private:
+  SHA256 inner; // state after the key XOR ipad block
+  SHA256 outer; // state after the key XOR opad block
+  SHA256 work;
+};
+
+#endif // HMAC_CONTEXT_H
@@ -0,0 +1,102 @@
+#ifndef HOP_CLOCK_H
+#define HOP_CLOCK_H
+
+#include <Arduino.h>
+
+// 64-bit monotonic hop clock for the SAMD51.
+//
+// TC0/TC1 run as one free-running 32-bit counter on the 32.768 kHz crystal
+// (GCLK3), and the overflow interrupt extends it to 64 bits, so the clock
+// does not wrap for the life of the deployment (millis() wraps after about
+// 49.7 days). The hop dwell is a power of two ticks, so the hop index and
+// the phase within the hop are a shift and a mask; there is no division on
+// the hot path. A dwell shift of 15 gives a 1 s dwell.
+//
+// The sketch must forward the interrupt:
+//   void TC0_Handler() { hopClock.handleInterrupt(); }
+
+#define HOP_CLOCK TC0
+#define HOP_CLOCK_IRQn TC0_IRQn
+#define HOP_CLOCK_HZ 32768
+
+class HopClock {
+public:
+  HopClock() : overflows(0), offset(0), dwellShift(15) {}
+
+  void begin(uint8_t hopDwellShift) {
+    dwellShift = hopDwellShift;
+
+    MCLK->APBAMASK.reg |= MCLK_APBAMASK_TC0 | MCLK_APBAMASK_TC1;
+    GCLK->PCHCTRL[TC0_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK3 | GCLK_PCHCTRL_CHEN;
+    while (!(GCLK->PCHCTRL[TC0_GCLK_ID].reg & GCLK_PCHCTRL_CHEN));
+
+    HOP_CLOCK->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+    while (HOP_CLOCK->COUNT32.SYNCBUSY.bit.SWRST);
+    HOP_CLOCK->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV1;
+    HOP_CLOCK->COUNT32.WAVE.reg = TC_WAVE_WAVEGEN_NFRQ;
+    HOP_CLOCK->COUNT32.INTFLAG.reg = TC_INTFLAG_OVF;
+    HOP_CLOCK->COUNT32.INTENSET.reg = TC_INTENSET_OVF;
+
+    NVIC_SetPriority(HOP_CLOCK_IRQn, 0);
+    NVIC_EnableIRQ(HOP_CLOCK_IRQn);
+    HOP_CLOCK->COUNT32.CTRLA.bit.ENABLE = 1;
+    while (HOP_CLOCK->COUNT32.SYNCBUSY.bit.ENABLE);
+  }
+
+  // Network time in ticks (local counter plus the sync offset)
+  uint64_t now() {
+    return localTicks() + offset;
+  }
+
+  uint64_t hopIndex() {
+    return now() >> dwellShift;
+  }
+
+  // Ticks elapsed since the start of the current hop
+  uint32_t hopPhase() {
+    return (uint32_t)now() & (((uint32_t)1 << dwellShift) - 1);
+  }
+
+  uint32_t dwellTicks() const {
+    return (uint32_t)1 << dwellShift;
+  }
+
+  // Align network time with a timestamp received from the master
+  void setTime(uint64_t networkTicks) {
+    offset = (int64_t)(networkTicks - localTicks());
+  }
+
+  void handleInterrupt() {
+    if (HOP_CLOCK->COUNT32.INTFLAG.reg & TC_INTFLAG_OVF) {
+      HOP_CLOCK->COUNT32.INTFLAG.reg = TC_INTFLAG_OVF;
+      overflows++;
+    }
+  }
+
+private:
+  uint64_t localTicks() {
+    noInterrupts();
+    uint32_t high = overflows;
+    uint32_t low = readCount();
+    // An overflow that has not been serviced yet belongs to this reading
+    if (HOP_CLOCK->COUNT32.INTFLAG.reg & TC_INTFLAG_OVF) {
+      low = readCount();
+      high++;
+    }
+    interrupts();
+    return ((uint64_t)high << 32) | low;
+  }
+
+  static uint32_t readCount() {
+    HOP_CLOCK->COUNT32.CTRLBSET.reg = TC_CTRLBSET_CMD_READSYNC;
+    while (HOP_CLOCK->COUNT32.SYNCBUSY.bit.CTRLB);
+    while (HOP_CLOCK->COUNT32.SYNCBUSY.bit.COUNT);
+    return HOP_CLOCK->COUNT32.COUNT.reg;
+  }
+
+  volatile uint32_t overflows;
+  int64_t offset;
+  uint8_t dwellShift;
+};
+
+#endif // HOP_CLOCK_H
@@ -0,0 +1,138 @@
+#ifndef HOP_PERMUTATION_H
+#define HOP_PERMUTATION_H
+
+#include "HopSequence.h"
+
+// Permutation hopping: every hop epoch of N hops visits each of the N
+// channels exactly once, in a key-derived order.
+//
+// The order is a small-domain Feistel cipher over the smallest even number
+// of bits that covers N, with cycle walking to stay inside [0, N). Its round
+// keys for epoch e are the first words of ChaCha block e of a keystream
+// separate from the plain hop sequence, so moving into a new epoch costs one
+// ChaCha block and hop n is found in O(1) without building a table.
+//
+// Epochs are counted from the first hop of the key (begin()), so after a
+// rollover the new key starts a whole epoch at its activation hop. The old
+// key's last epoch is cut short there: its remaining channels are not
+// visited.
+//
+// channel() keeps the epoch and position of the last hop it was asked for
+// and steps them forward, so the hop path does no 64-bit division (a
+// library call on the Cortex-M4); only a jump backwards or by a whole epoch
+// or more, such as late network entry, divides.
+
+#define HOP_PERMUTATION_ROUNDS 8
+#define HOP_PERMUTATION_STREAM 1 // ChaCha nonce for the round key stream
+
+class HopPermutation {
+public:
+  // channelCount must be at least 1
+  explicit HopPermutation(uint32_t channelCount)
+    : count(channelCount), halfBits(0), firstHop(0), cachedEpoch(0), keysValid(false),
+      lastHop(0), lastEpoch(0), lastPosition(0), positionValid(false) {
+    while (halfBits < 16 && ((uint64_t)1 << (2 * halfBits)) < channelCount) {
+      halfBits++;
+    }
+  }
+
+  // Key the permutation; epoch 0 starts at keyFirstHop
+  void begin(const uint8_t *key, uint64_t keyFirstHop = 0) {
+    roundKeyStream.begin(key, HOP_PERMUTATION_STREAM);
+    firstHop = keyFirstHop;
+    keysValid = false;
+    positionValid = false;
+  }
+
+  uint32_t size() const {
+    return count;
+  }
+
+  // Channel for hop index n, counting epochs from the key's first hop (hops
+  // before it count on from the end of the 64-bit hop space)
+  uint32_t channel(uint64_t hop) {
+    uint64_t n = hop - firstHop;
+    if (positionValid && n >= lastHop && n - lastHop < count) {
+      // The next hop, or a few hops on: no division
+      uint64_t position = lastPosition + (n - lastHop);
+      if (position >= count) {
+        position -= count;
+        lastEpoch++;
+      }
+      lastPosition = (uint32_t)position;
+    } else {
+      lastEpoch = n / count;
+      lastPosition = (uint32_t)(n - lastEpoch * count);
+      positionValid = true;
+    }
+    lastHop = n;
+    return permute(lastEpoch, lastPosition);
+  }
+
+  // Position i (0 <= i < size()) of the permutation for the given epoch,
+  // counted from the key's first hop
+  uint32_t permute(uint64_t epoch, uint32_t i) {
+    if (!keysValid || epoch != cachedEpoch) {
+      loadRoundKeys(epoch);
+    }
+    // Cycle walking: the Feistel domain is less than 4N, so this takes
+    // fewer than four rounds of encryption on average.
+    uint32_t x = i;
+    do {
+      x = encrypt(x);
+    } while (x >= count);
+    return x;
+  }
+
+  void clear() {
+    roundKeyStream.clear();
+    clean(roundKeys, sizeof(roundKeys));
+    keysValid = false;
+  }
+
+private:
+  void loadRoundKeys(uint64_t epoch) {
+    for (int r = 0; r < HOP_PERMUTATION_ROUNDS; r++) {
+      roundKeys[r] = roundKeyStream.word(epoch, r);
+    }
+    cachedEpoch = epoch;
+    keysValid = true;
+  }
+
+  uint32_t encrypt(uint32_t x) const {
+    uint32_t mask = ((uint32_t)1 << halfBits) - 1;
+    uint32_t left = x >> halfBits;
+    uint32_t right = x & mask;
+    for (int r = 0; r < HOP_PERMUTATION_ROUNDS; r++) {
+      uint32_t next = left ^ (roundFunction(right, roundKeys[r]) & mask);
+      left = right;
+      right = next;
+    }
+    return (left << halfBits) | right;
+  }
+
+  // Keyed 32-bit mixing function (murmur3 finalizer on x ^ k)
+  static uint32_t roundFunction(uint32_t x, uint32_t k) {
+    x ^= k;
+    x ^= x >> 16;
+    x *= 0x85EBCA6BUL;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35UL;
+    x ^= x >> 16;
+    return x;
+  }
+
+  uint32_t count;
+  uint8_t halfBits;
+  uint64_t firstHop; // epoch 0 starts here
+  uint64_t cachedEpoch;
+  bool keysValid;
+  uint64_t lastHop; // last hop passed to channel(), from firstHop, and its epoch and position
+  uint64_t lastEpoch;
+  uint32_t lastPosition;
+  bool positionValid;
+  uint32_t roundKeys[HOP_PERMUTATION_ROUNDS];
+  HopSequence roundKeyStream;
+};
+
+#endif // HOP_PERMUTATION_H
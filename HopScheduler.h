@@ -0,0 +1,248 @@
+#ifndef HOP_SCHEDULER_H
+#define HOP_SCHEDULER_H
+
+#include <Arduino.h>
+
+// Timer-driven hop scheduler for the SAMD51.
+//
+// TC2/TC3 run as one free-running 32-bit counter at 3 MHz (GCLK1 48 MHz / 16).
+// Hops happen on the CC0 compare interrupt at absolute deadlines: the ISR
+// adds the hop interval to the previous deadline rather than to the current
+// time, so interrupt latency never accumulates and the schedule cannot drift.
+//
+// loop() pre-stages the channel for the next hop while the current one is
+// dwelling, and the ISR only commits it. The lateness of every commit is
+// recorded in a histogram so hop jitter can be measured on the bench.
+//
+// The scheduler only reaches the timer through the HopTimer interface:
+// Tc2HopTimer on the SAMD51, or a simulated timer that calls
+// handleInterrupt() itself (HopSchedulerBenchmark.ino). On the board the
+// sketch must forward the interrupt:
+//   void TC2_Handler() { hopScheduler.handleInterrupt(); }
+
+#define HOP_TIMER_TICKS_PER_US 3
+#define HOP_JITTER_BINS 16 // 1 us per bin, last bin collects everything later
+
+typedef void (*HopCommitFunction)(uint32_t channel);
+
+// Free-running 32-bit counter at HOP_TIMER_TICKS_PER_US with one compare
+// channel whose match raises the hop interrupt
+class HopTimer {
+public:
+  virtual ~HopTimer() {}
+  virtual void begin() = 0;
+  virtual uint32_t now() = 0;
+  virtual void setCompare(uint32_t ticks) = 0;
+  // Clear any stale match and enable the interrupt
+  virtual void enableCompare() = 0;
+  virtual void disableCompare() = 0;
+  // True, clearing it, if the compare match is pending
+  virtual bool takeCompare() = 0;
+};
+
+#if defined(__SAMD51__)
+#define HOP_TIMER TC2
+#define HOP_TIMER_IRQn TC2_IRQn
+
+// TC2/TC3 as one 32-bit counter clocked from GCLK1 (48 MHz / 16)
+class Tc2HopTimer : public HopTimer {
+public:
+  void begin() {
+    MCLK->APBBMASK.reg |= MCLK_APBBMASK_TC2 | MCLK_APBBMASK_TC3;
+    GCLK->PCHCTRL[TC2_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+    while (!(GCLK->PCHCTRL[TC2_GCLK_ID].reg & GCLK_PCHCTRL_CHEN));
+
+    HOP_TIMER->COUNT32.CTRLA.reg = TC_CTRLA_SWRST;
+    while (HOP_TIMER->COUNT32.SYNCBUSY.bit.SWRST);
+    HOP_TIMER->COUNT32.CTRLA.reg = TC_CTRLA_MODE_COUNT32 | TC_CTRLA_PRESCALER_DIV16 |
+                                   TC_CTRLA_PRESCSYNC_PRESC;
+    HOP_TIMER->COUNT32.WAVE.reg = TC_WAVE_WAVEGEN_NFRQ;
+
+    NVIC_SetPriority(HOP_TIMER_IRQn, 0);
+    NVIC_EnableIRQ(HOP_TIMER_IRQn);
+    HOP_TIMER->COUNT32.CTRLA.bit.ENABLE = 1;
+    while (HOP_TIMER->COUNT32.SYNCBUSY.bit.ENABLE);
+  }
+
+  uint32_t now() {
+    HOP_TIMER->COUNT32.CTRLBSET.reg = TC_CTRLBSET_CMD_READSYNC;
+    while (HOP_TIMER->COUNT32.SYNCBUSY.bit.CTRLB);
+    while (HOP_TIMER->COUNT32.SYNCBUSY.bit.COUNT);
+    return HOP_TIMER->COUNT32.COUNT.reg;
+  }
+
+  void setCompare(uint32_t ticks) {
+    HOP_TIMER->COUNT32.CC[0].reg = ticks;
+    while (HOP_TIMER->COUNT32.SYNCBUSY.bit.CC0);
+  }
+
+  void enableCompare() {
+    HOP_TIMER->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+    HOP_TIMER->COUNT32.INTENSET.reg = TC_INTENSET_MC0;
+  }
+
+  void disableCompare() {
+    HOP_TIMER->COUNT32.INTENCLR.reg = TC_INTENCLR_MC0;
+  }
+
+  bool takeCompare() {
+    if (!(HOP_TIMER->COUNT32.INTFLAG.reg & TC_INTFLAG_MC0)) {
+      return false;
+    }
+    HOP_TIMER->COUNT32.INTFLAG.reg = TC_INTFLAG_MC0;
+    return true;
+  }
+};
+#endif
+
+class HopScheduler {
+public:
+  HopScheduler(HopTimer &hopTimer)
+    : timer(hopTimer), commitFunction(NULL), intervalTicks(0), deadline(0), nextHop(0),
+      activeHop(0), activeChannel(0), staged(false), stagedHop(0), stagedChannel(0),
+      missedStages(0), maxLateTicks(0) {
+    for (int i = 0; i < HOP_JITTER_BINS; i++) {
+      jitterBins[i] = 0;
+    }
+  }
+
+  // Configure the timer. commit is called from the interrupt with the
+  // staged channel, so it must be short and must not use Serial.
+  void begin(uint32_t hopIntervalMicros, HopCommitFunction commit) {
+    intervalTicks = hopIntervalMicros * HOP_TIMER_TICKS_PER_US;
+    commitFunction = commit;
+    timer.begin();
+  }
+
+  // Commit the first hop now and schedule the following ones
+  void start(uint64_t firstHop, uint32_t firstChannel) {
+    noInterrupts();
+    activeHop = firstHop;
+    activeChannel = firstChannel;
+    nextHop = firstHop + 1;
+    staged = false;
+    deadline = timer.now() + intervalTicks;
+    timer.setCompare(deadline);
+    timer.enableCompare();
+    interrupts();
+    commitFunction(firstChannel);
+  }
+
+  void stop() {
+    timer.disableCompare();
+  }
+
+  // True when the next hop has no channel staged yet, including when the
+  // hop staged last has already passed; hopIndex receives the hop that
+  // needs one.
+  bool needsStaging(uint64_t *hopIndex) {
+    noInterrupts();
+    bool needed = !staged || stagedHop != nextHop;
+    *hopIndex = nextHop;
+    interrupts();
+    return needed;
+  }
+
+  // Returns false, staging nothing, if the interrupt has moved past
+  // hopIndex since needsStaging(); the next needsStaging() call asks for
+  // the new hop.
+  bool stage(uint64_t hopIndex, uint32_t channel) {
+    noInterrupts();
+    bool current = hopIndex == nextHop;
+    if (current) {
+      stagedHop = hopIndex;
+      stagedChannel = channel;
+      staged = true;
+    }
+    interrupts();
+    return current;
+  }
+
+  void handleInterrupt() {
+    if (!timer.takeCompare()) {
+      return;
+    }
+
+    uint32_t lateTicks = timer.now() - deadline;
+    if (staged && stagedHop == nextHop) {
+      commitFunction(stagedChannel);
+      activeChannel = stagedChannel;
+    } else {
+      missedStages++; // keep dwelling on the current channel
+    }
+    activeHop = nextHop;
+    nextHop++;
+    staged = false;
+
+    deadline += intervalTicks;
+    timer.setCompare(deadline);
+    // The compare only matches when the counter reaches it, so a deadline
+    // that passed while interrupts were held off, or while the compare
+    // value was being written, would stop hopping until the 32-bit counter
+    // wraps (~24 min). Skip the missed hops instead, checking again after
+    // each write and dropping the match of any deadline skipped.
+    while ((int32_t)(timer.now() - deadline) >= 0) {
+      deadline += intervalTicks;
+      nextHop++;
+      missedStages++;
+      timer.setCompare(deadline);
+      timer.takeCompare();
+    }
+    recordJitter(lateTicks);
+  }
+
+  uint64_t currentHop() {
+    noInterrupts();
+    uint64_t hop = activeHop;
+    interrupts();
+    return hop;
+  }
+
+  uint32_t currentChannel() const {
+    return activeChannel;
+  }
+
+  uint32_t missedStageCount() const {
+    return missedStages;
+  }
+
+  // Commit lateness histogram; bin i counts hops committed i..i+1 us late
+  void jitterHistogram(uint32_t *bins, uint32_t *maxLateMicros) {
+    noInterrupts();
+    memcpy(bins, (const void *)jitterBins, sizeof(jitterBins));
+    *maxLateMicros = maxLateTicks / HOP_TIMER_TICKS_PER_US;
+    interrupts();
+  }
+
+  void resetJitter() {
+    noInterrupts();
+    memset((void *)jitterBins, 0, sizeof(jitterBins));
+    maxLateTicks = 0;
+    interrupts();
+  }
+
+private:
+  void recordJitter(uint32_t lateTicks) {
+    uint32_t bin = lateTicks / HOP_TIMER_TICKS_PER_US;
+    jitterBins[bin < HOP_JITTER_BINS ? bin : HOP_JITTER_BINS - 1]++;
+    if (lateTicks > maxLateTicks) {
+      maxLateTicks = lateTicks;
+    }
+  }
+
+  HopTimer &timer;
+  HopCommitFunction commitFunction;
+  uint32_t intervalTicks;
+  uint32_t deadline;
+  volatile uint64_t nextHop;
+  volatile uint64_t activeHop;
+  volatile uint32_t activeChannel;
+  volatile bool staged;
+  volatile uint64_t stagedHop;
+  volatile uint32_t stagedChannel;
+  volatile uint32_t missedStages;
+  volatile uint32_t jitterBins[HOP_JITTER_BINS];
+  volatile uint32_t maxLateTicks;
+};
+
+#endif // HOP_SCHEDULER_H
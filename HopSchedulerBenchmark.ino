@@ -0,0 +1,175 @@
+#include "HopScheduler.h"
+
+// The hop scheduler on a simulated timer: the sketch plays the timer and
+// calls handleInterrupt() itself, with random interrupt latency, so the
+// schedule can be checked for drift without a board or a scope. Time is
+// counted in timer ticks so runs are repeatable.
+//
+// Checks that every deadline is exactly one interval after the previous
+// one, that no compare value is armed behind the counter (it would only
+// match after the counter wraps), that the committed channel is the one
+// for the active hop whenever loop() staged it in time, and that a hop
+// interrupt landing between needsStaging() and stage() costs only that
+// one hop.
+
+#define HOP_INTERVAL_US 500
+#define HOPS 100000
+#define MAX_LATENCY_TICKS 40    // interrupt latency, up to ~13 us
+#define RACE_PERCENT 5          // loop() preempted between needsStaging() and stage()
+#define STALL_PER_MILLE 2       // interrupts held off for more than a whole interval
+#define WRITE_STALL_PER_MILLE 2 // the interrupt held up as long before writing the compare
+
+class SimulatedHopTimer : public HopTimer {
+public:
+  SimulatedHopTimer()
+    : ticks(0), compare(0), enabled(false), pending(false), writeDelayTicks(0),
+      comparesBehind(0) {}
+
+  void begin() {
+    ticks = 0x7FFFF000; // start close to a wrap of the 32-bit counter
+  }
+
+  uint32_t now() {
+    return ticks;
+  }
+
+  // The counter runs on while a write is held up, so the value may already
+  // be behind it when it lands
+  void setCompare(uint32_t value) {
+    ticks += writeDelayTicks;
+    writeDelayTicks = 0;
+    compare = value;
+  }
+
+  void enableCompare() {
+    pending = false;
+    enabled = true;
+  }
+
+  void disableCompare() {
+    enabled = false;
+  }
+
+  bool takeCompare() {
+    bool wasPending = pending;
+    pending = false;
+    return wasPending;
+  }
+
+  // Run up to the compare match, then on by the interrupt latency. A value
+  // the counter has already passed would only match after it wraps; that
+  // is counted and the run goes on as if it had matched.
+  void runToCompare(uint32_t latencyTicks) {
+    comparesBehind += !pending && (int32_t)(compare - ticks) <= 0;
+    ticks = compare + latencyTicks;
+    pending = enabled;
+  }
+
+  uint32_t ticks;
+  uint32_t compare;
+  bool enabled;
+  bool pending;
+  uint32_t writeDelayTicks; // held up this long by the next setCompare()
+  uint32_t comparesBehind;
+};
+
+SimulatedHopTimer simulatedTimer;
+HopScheduler hopScheduler(simulatedTimer);
+uint32_t committedChannel;
+uint32_t elapsedHops; // hop deadlines the simulated time has passed
+uint32_t randomState = 1;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  Serial.println("Hop scheduler on a simulated timer");
+  hopScheduler.begin(HOP_INTERVAL_US, commitChannel);
+  hopScheduler.start(0, channelForHop(0));
+  uint32_t firstDeadline = simulatedTimer.compare;
+
+  uint32_t races = 0, stalledHops = 0, wrongChannels = 0, checkedHops = 0;
+  uint32_t driftedDeadlines = 0;
+  for (uint32_t hop = 0; hop < HOPS; hop++) {
+    // loop(): stage the next hop, sometimes preempted by the hop interrupt
+    uint64_t stageHop;
+    if (hopScheduler.needsStaging(&stageHop)) {
+      if (nextRandom() % 100 < RACE_PERCENT) {
+        races++;
+        fireInterrupt(&stalledHops);
+      }
+      hopScheduler.stage(stageHop, channelForHop(stageHop));
+    }
+    // The staged hop may have passed; loop() comes round and asks again
+    if (hopScheduler.needsStaging(&stageHop)) {
+      hopScheduler.stage(stageHop, channelForHop(stageHop));
+    }
+
+    uint32_t missed = hopScheduler.missedStageCount();
+    uint32_t skipped = fireInterrupt(&stalledHops);
+
+    // Deadlines are absolute: after n hops the compare value is exactly n
+    // intervals past the first deadline, however late the interrupts ran
+    uint32_t expected = firstDeadline + elapsedHops * HOP_INTERVAL_US * HOP_TIMER_TICKS_PER_US;
+    driftedDeadlines += simulatedTimer.compare != expected;
+    // A hop loop() did not stage in time keeps dwelling on the previous
+    // channel; every other hop must be on its own
+    if (hopScheduler.missedStageCount() - missed == skipped) {
+      checkedHops++;
+      wrongChannels += committedChannel != channelForHop(hopScheduler.currentHop());
+    }
+  }
+
+  uint32_t bins[HOP_JITTER_BINS], maxLateMicros;
+  hopScheduler.jitterHistogram(bins, &maxLateMicros);
+  Serial.println("  hops: " + String(HOPS) + ", drifted deadlines: " + String(driftedDeadlines) +
+                 ", compare values armed behind the counter: " +
+                 String(simulatedTimer.comparesBehind) + ", max late: " +
+                 String(maxLateMicros) + " us");
+  Serial.println("  missed stages: " + String(hopScheduler.missedStageCount()) + ", expected " +
+                 String(races + stalledHops) + " (" + String(races) + " races, " +
+                 String(stalledHops) + " hops skipped by stalls)");
+  Serial.println("  hops on another hop's channel: " + String(wrongChannels) + " of " +
+                 String(checkedHops) + " staged in time");
+}
+
+void loop() {
+}
+
+uint32_t nextRandom() {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 8;
+}
+
+uint32_t channelForHop(uint64_t hop) {
+  return (uint32_t)(hop * 37 % 101);
+}
+
+void commitChannel(uint32_t channel) {
+  committedChannel = channel;
+}
+
+// The next compare match, usually a little late and now and then held off
+// past one or more following deadlines, either before the interrupt runs
+// or before its write of the next compare value lands. Returns the hops skipped.
+uint32_t fireInterrupt(uint32_t *stalledHops) {
+  uint32_t intervalTicks = HOP_INTERVAL_US * HOP_TIMER_TICKS_PER_US;
+  uint32_t latency = nextRandom() % MAX_LATENCY_TICKS;
+  uint32_t skipped = 0;
+  if (nextRandom() % 1000 < STALL_PER_MILLE) {
+    skipped = 1 + nextRandom() % 3;
+    latency += skipped * intervalTicks;
+  } else if (nextRandom() % 1000 < WRITE_STALL_PER_MILLE) {
+    skipped = 1 + nextRandom() % 3;
+    simulatedTimer.writeDelayTicks = skipped * intervalTicks;
+  }
+  *stalledHops += skipped;
+  elapsedHops += 1 + skipped;
+  simulatedTimer.runToCompare(latency);
+  hopScheduler.handleInterrupt();
+  // A match raised while the interrupt ran enters it again at once
+  while (simulatedTimer.pending) {
+    hopScheduler.handleInterrupt();
+  }
+  return skipped;
+}
@@ -0,0 +1,128 @@
+#ifndef HOP_SEQUENCE_H
+#define HOP_SEQUENCE_H
+
+#include <ChaCha.h>
+#include <Crypto.h>
+#include "ChannelMap.h"
+
+// Deterministic frequency hopping sequence keyed by the TRANSEC key.
+//
+// Hop n is 32-bit word (n % 16) of ChaCha20 keystream block (n / 16), with
+// the block number loaded directly as the 64-bit ChaCha counter. Any hop can
+// therefore be computed on its own in constant time, and both boards holding
+// the same key produce the same sequence. Only the most recent keystream
+// block (64 bytes) is kept, so sequential hops cost one ChaCha block every
+// 16 hops and no pattern table is needed.
+
+#define HOP_KEY_LENGTH 32
+#define HOP_WORDS_PER_BLOCK 16
+#define HOP_BLOCK_SIZE (HOP_WORDS_PER_BLOCK * 4)
+
+// Words rejected by ChannelMap are replaced from a separate keystream: the
+// same key under the stream id with its top bit set, so stream ids must stay
+// below 2^63. Retry block n holds the HOP_RETRY_ATTEMPTS replacement words
+// for hop n, keeping the channel for hop n a pure function of n. A word is
+// rejected with probability below channels / 2^32, so all of them failing
+// never happens in practice; if it did, the last word is reduced with the
+// rejection skipped rather than looping.
+#define HOP_RETRY_STREAM 0x8000000000000000ULL
+#define HOP_RETRY_ATTEMPTS HOP_WORDS_PER_BLOCK
+
+class HopSequence {
+public:
+  HopSequence() : cipher(20), stream(0), cachedBlock(0), blockValid(false) {}
+
+  // Key the sequence. The stream id separates independent sequences
+  // derived from the same key (it is used as the ChaCha nonce; the top bit
+  // is reserved for the retry stream).
+  void begin(const uint8_t *key, uint64_t streamId = 0) {
+    stream = streamId & ~HOP_RETRY_STREAM;
+    cipher.setKey(key, HOP_KEY_LENGTH);
+    setStream(stream);
+    blockValid = false;
+  }
+
+  // Raw 32-bit pseudorandom word for hop index n
+  uint32_t hop(uint64_t n) {
+    return word(n / HOP_WORDS_PER_BLOCK, (uint32_t)(n % HOP_WORDS_PER_BLOCK));
+  }
+
+  // Word index (below HOP_WORDS_PER_BLOCK) of keystream block blockNumber,
+  // for users that number blocks themselves over the whole 64-bit counter
+  uint32_t word(uint64_t blockNumber, uint32_t index) {
+    if (!blockValid || blockNumber != cachedBlock) {
+      generateBlock(blockNumber);
+    }
+    return readWord(block + 4 * index);
+  }
+
+  // Unbiased channel in [0, map.size()) for hop index n
+  uint32_t channel(uint64_t n, const ChannelMap &map) {
+    uint32_t result;
+    if (map.reduce(hop(n), &result)) {
+      return result;
+    }
+    // Rare path: one block of the retry stream, then back to the hop stream
+    // (its cached block is untouched)
+    uint8_t retryBlock[HOP_BLOCK_SIZE];
+    setStream(stream | HOP_RETRY_STREAM);
+    generate(n, retryBlock);
+    setStream(stream);
+    uint32_t word = 0;
+    bool found = false;
+    for (int attempt = 0; attempt < HOP_RETRY_ATTEMPTS && !found; attempt++) {
+      word = readWord(retryBlock + 4 * attempt);
+      found = map.reduce(word, &result);
+    }
+    clean(retryBlock, sizeof(retryBlock));
+    if (!found) {
+      result = (uint32_t)(((uint64_t)word * map.size()) >> 32);
+    }
+    return result;
+  }
+
+  void clear() {
+    cipher.clear();
+    clean(block, sizeof(block));
+    blockValid = false;
+  }
+
+private:
+  static uint32_t readWord(const uint8_t *w) {
+    return (uint32_t)w[0] | ((uint32_t)w[1] << 8) |
+           ((uint32_t)w[2] << 16) | ((uint32_t)w[3] << 24);
+  }
+
+  // The stream id is the ChaCha nonce
+  void setStream(uint64_t streamId) {
+    uint8_t iv[8];
+    for (int i = 0; i < 8; i++) {
+      iv[i] = (uint8_t)(streamId >> (8 * i));
+    }
+    cipher.setIV(iv, sizeof(iv));
+  }
+
+  void generate(uint64_t blockNumber, uint8_t *output) {
+    uint8_t counter[8];
+    for (int i = 0; i < 8; i++) {
+      counter[i] = (uint8_t)(blockNumber >> (8 * i));
+    }
+    cipher.setCounter(counter, sizeof(counter));
+    memset(output, 0, HOP_BLOCK_SIZE);
+    cipher.encrypt(output, output, HOP_BLOCK_SIZE);
+  }
+
+  void generateBlock(uint64_t blockNumber) {
+    generate(blockNumber, block);
+    cachedBlock = blockNumber;
+    blockValid = true;
+  }
+
+  ChaCha cipher;
+  uint64_t stream;
+  uint64_t cachedBlock;
+  bool blockValid;
+  uint8_t block[HOP_BLOCK_SIZE];
+};
+
+#endif // HOP_SEQUENCE_H
@@ -0,0 +1,191 @@
+#include "CycleCounter.h"
+#include "HopSequence.h"
+#include "HopPermutation.h"
+
+#define BENCHMARK_HOPS 100000
+#define MAPPING_SAMPLES 1000000
+#define CHI_SQUARE_HOPS 100000000UL
+#define CHI_SQUARE_CHANNELS 100
+#define CHI_SQUARE_CRITICAL_99 134.6 // chi-square, 99 degrees of freedom, p = 0.01
+#define ROLLOVER_HOP 1234567 // a key activation hop that is not on an epoch boundary
+#define ROLLOVER_EPOCHS 4
+
+// Fixed example key so runs are comparable between boards
+const uint8_t BENCHMARK_KEY[HOP_KEY_LENGTH] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+  0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+
+HopSequence hopSequence;
+const ChannelMap channelMap(CHI_SQUARE_CHANNELS);
+HopPermutation hopPermutation(CHI_SQUARE_CHANNELS);
+uint32_t unbiasedCounts[CHI_SQUARE_CHANNELS];
+uint32_t byteModuloCounts[CHI_SQUARE_CHANNELS];
+volatile uint32_t sink; // keeps the compiler from discarding results
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  hopSequence.begin(BENCHMARK_KEY);
+  hopPermutation.begin(BENCHMARK_KEY);
+
+  Serial.println("HopSequence benchmark");
+  benchmarkHops("sequential", 1);
+  // A stride of one block forces a fresh ChaCha block for every hop,
+  // which is the worst case for random access into the sequence.
+  benchmarkHops("random access", HOP_WORDS_PER_BLOCK);
+  benchmarkChannelMapping();
+  benchmarkPermutation();
+  chiSquareReport();
+}
+
+void loop() {
+}
+
+void benchmarkHops(const char *label, uint64_t stride) {
+  uint32_t acc = 0;
+  unsigned long startMicros = micros();
+  uint32_t startCycles = cycleCount();
+  for (uint32_t i = 0; i < BENCHMARK_HOPS; i++) {
+    acc ^= hopSequence.hop(i * stride);
+  }
+  uint32_t cycles = cycleCount() - startCycles;
+  unsigned long elapsed = micros() - startMicros;
+  sink = acc;
+
+  Serial.print("  ");
+  Serial.print(label);
+  Serial.print(": ");
+  Serial.print((float)BENCHMARK_HOPS * 1000000.0f / elapsed, 0);
+  Serial.print(" hops/s, ");
+  Serial.print((float)cycles / BENCHMARK_HOPS, 1);
+  Serial.println(" cycles/hop");
+}
+
+// Cost of reducing a word to a channel, isolated from the hop generator by
+// feeding both methods the same xorshift stream.
+void benchmarkChannelMapping() {
+  uint32_t x = 2463534242UL;
+  uint32_t acc = 0;
+  uint32_t startCycles = cycleCount();
+  for (uint32_t i = 0; i < MAPPING_SAMPLES; i++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    acc += x % channelMap.size(); // runtime divisor, as in the hop path
+  }
+  uint32_t moduloCycles = cycleCount() - startCycles;
+
+  x = 2463534242UL;
+  startCycles = cycleCount();
+  for (uint32_t i = 0; i < MAPPING_SAMPLES; i++) {
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    uint32_t channel;
+    if (channelMap.reduce(x, &channel)) {
+      acc += channel;
+    }
+  }
+  uint32_t multiplyShiftCycles = cycleCount() - startCycles;
+  sink = acc;
+
+  Serial.print("  modulo reduction: ");
+  Serial.print((float)moduloCycles / MAPPING_SAMPLES, 2);
+  Serial.println(" cycles/word");
+  Serial.print("  multiply-shift reduction: ");
+  Serial.print((float)multiplyShiftCycles / MAPPING_SAMPLES, 2);
+  Serial.println(" cycles/word");
+}
+
+// Permutation hopping lookup cost, including one round key refresh per
+// epoch, and a check that every epoch used each channel exactly once, also
+// when the key takes effect part way through an epoch of the old one.
+void benchmarkPermutation() {
+  uint32_t acc = 0;
+  uint32_t startCycles = cycleCount();
+  for (uint32_t i = 0; i < BENCHMARK_HOPS; i++) {
+    acc += hopPermutation.channel(i);
+  }
+  uint32_t cycles = cycleCount() - startCycles;
+  sink = acc;
+
+  bool fullCoverage = true;
+  for (uint32_t epoch = 0; epoch < BENCHMARK_HOPS / CHI_SQUARE_CHANNELS; epoch++) {
+    memset(unbiasedCounts, 0, sizeof(unbiasedCounts));
+    for (uint32_t i = 0; i < CHI_SQUARE_CHANNELS; i++) {
+      unbiasedCounts[hopPermutation.permute(epoch, i)]++;
+    }
+    for (int c = 0; c < CHI_SQUARE_CHANNELS; c++) {
+      fullCoverage = fullCoverage && unbiasedCounts[c] == 1;
+    }
+  }
+
+  // Epochs of a key start at its activation hop
+  HopPermutation rekeyed(CHI_SQUARE_CHANNELS);
+  rekeyed.begin(BENCHMARK_KEY, ROLLOVER_HOP);
+  bool alignedCoverage = true;
+  for (uint32_t epoch = 0; epoch < ROLLOVER_EPOCHS; epoch++) {
+    memset(unbiasedCounts, 0, sizeof(unbiasedCounts));
+    for (uint32_t i = 0; i < CHI_SQUARE_CHANNELS; i++) {
+      unbiasedCounts[rekeyed.channel(ROLLOVER_HOP + epoch * CHI_SQUARE_CHANNELS + i)]++;
+    }
+    for (int c = 0; c < CHI_SQUARE_CHANNELS; c++) {
+      alignedCoverage = alignedCoverage && unbiasedCounts[c] == 1;
+    }
+  }
+
+  // Round keys come from keystream block e for every 64-bit epoch e; epochs
+  // 2^60 apart once shared a block
+  uint64_t farEpoch = (1ULL << 60) + 7;
+  bool farKeysDiffer = false;
+  for (uint32_t i = 0; i < CHI_SQUARE_CHANNELS; i++) {
+    farKeysDiffer |= hopPermutation.permute(7, i) != hopPermutation.permute(farEpoch, i);
+  }
+
+  Serial.print("  permutation: ");
+  Serial.print((float)cycles / BENCHMARK_HOPS, 1);
+  Serial.print(" cycles/hop, every channel once per epoch: ");
+  Serial.print(fullCoverage ? "yes" : "NO");
+  Serial.print(", from a key's activation hop: ");
+  Serial.print(alignedCoverage ? "yes" : "NO");
+  Serial.print(", epochs 2^60 apart keyed apart: ");
+  Serial.println(farKeysDiffer ? "yes" : "NO");
+}
+
+// Channel occupancy over CHI_SQUARE_HOPS hops for the unbiased mapping and
+// for the previous key byte % 100 mapping. Takes a minute or two to run.
+void chiSquareReport() {
+  memset(unbiasedCounts, 0, sizeof(unbiasedCounts));
+  memset(byteModuloCounts, 0, sizeof(byteModuloCounts));
+
+  Serial.print("  chi-square over ");
+  Serial.print(CHI_SQUARE_HOPS);
+  Serial.println(" hops...");
+  unsigned long startMicros = micros();
+  for (uint32_t i = 0; i < CHI_SQUARE_HOPS; i++) {
+    unbiasedCounts[hopSequence.channel(i, channelMap)]++;
+    byteModuloCounts[(uint8_t)hopSequence.hop(i) % CHI_SQUARE_CHANNELS]++;
+  }
+  unsigned long elapsed = micros() - startMicros;
+
+  Serial.print("  multiply-shift: chi-square = ");
+  Serial.println(chiSquare(unbiasedCounts), 1);
+  Serial.print("  byte modulo:    chi-square = ");
+  Serial.println(chiSquare(byteModuloCounts), 1);
+  Serial.print("  (99 degrees of freedom, p = 0.01 critical value ");
+  Serial.print(CHI_SQUARE_CRITICAL_99, 1);
+  Serial.print("; ran in ");
+  Serial.print(elapsed / 1000000.0f, 1);
+  Serial.println(" s)");
+}
+
+double chiSquare(const uint32_t *counts) {
+  double expected = (double)CHI_SQUARE_HOPS / CHI_SQUARE_CHANNELS;
+  double sum = 0;
+  for (int i = 0; i < CHI_SQUARE_CHANNELS; i++) {
+    double d = counts[i] - expected;
+    sum += d * d / expected;
+  }
+  return sum;
+}
@@ -0,0 +1,58 @@
+#ifndef HOP_TIME_OF_DAY_H
+#define HOP_TIME_OF_DAY_H
+
+#include <stdint.h>
+
+// Time-of-day indexed access to the hop sequence, for late network entry.
+//
+// Every node agrees on the time of hop 0 (the mission origin) and the dwell,
+// so a node that powers up mid-mission maps a coarse time of day straight to
+// a hop index and, through the keyed hop sequence, to a channel in O(1).
+// Clock uncertainty is covered by listening on the channels of the hops
+// around that index.
+
+struct HopCandidate {
+  uint64_t hopIndex;
+  uint32_t channel;
+};
+
+class HopTimeOfDay {
+public:
+  HopTimeOfDay(uint64_t originMillis, uint32_t dwellMillis)
+    : origin(originMillis), dwell(dwellMillis) {}
+
+  // Hop in progress at the given time of day
+  uint64_t hopAt(uint64_t todMillis) const {
+    if (todMillis <= origin) {
+      return 0;
+    }
+    return (todMillis - origin) / dwell;
+  }
+
+  // Time of day at which a hop starts
+  uint64_t hopStart(uint64_t hopIndex) const {
+    return origin + hopIndex * dwell;
+  }
+
+  // Fills out[] with the hops from centerHop - window to centerHop + window
+  // and their channels, using channelFor(hopIndex). out must have room for
+  // 2 * window + 1 entries. Returns the number of candidates written.
+  template <typename ChannelFunction>
+  uint16_t candidates(uint64_t centerHop, uint8_t window, ChannelFunction channelFor,
+                      HopCandidate *out) const {
+    uint64_t first = centerHop > window ? centerHop - window : 0;
+    uint16_t count = 0;
+    for (uint64_t hop = first; hop <= centerHop + window; hop++) {
+      out[count].hopIndex = hop;
+      out[count].channel = channelFor(hop);
+      count++;
+    }
+    return count;
+  }
+
+private:
+  uint64_t origin;
+  uint32_t dwell;
+};
+
+#endif // HOP_TIME_OF_DAY_H
@@ -0,0 +1,117 @@
+#ifndef IMPLICIT_NONCE_H
+#define IMPLICIT_NONCE_H
+
+#include <stdint.h>
+
+// Per-packet nonces (PACKET_NONCE_SIZE bytes) that both ends know without
+// sending them.
+//
+//   [epoch (2)] [hop index (5)] [link id (7 bits) | direction (1 bit)] [sequence (4)]
+//
+// all big-endian: the low 16 bits of the key epoch, the low 40 bits of the
+// hop index (17000 years of 500 ms hops), the link and direction, and a
+// per-link, per-direction sequence number that starts at 0 in every hop.
+// The epoch and hop are known to both ends from the hop clock, and a packet
+// can only be received on the channel of the hop it was sent in. The
+// sequence number goes on the air in full, in the authenticated header, so
+// the receiver never guesses it: any number of lost packets, within a hop
+// or across hops, leaves nothing to resync.
+// In exchange a (link, direction) can send at most PACKET_SEQUENCE_SPAN
+// packets per hop; next() refuses more until the hop changes, and refuses
+// any hop earlier than the last one it sent in. A nonce then never repeats
+// under one key and no IV goes on the air.
+//
+// The header bytes are [low byte of the hop] [sequence]. expand() refuses
+// a packet whose hop byte is not the receive hop's, so a packet recorded
+// in one hop and replayed in a later one is dropped with a compare instead
+// of costing a tag check (unless replayed a multiple of 256 hops later).
+
+#define PACKET_HOP_CHECK_BYTES 1
+#define PACKET_SEQUENCE_BYTES 1
+#define PACKET_NONCE_HEADER_BYTES (PACKET_HOP_CHECK_BYTES + PACKET_SEQUENCE_BYTES)
+#define PACKET_SEQUENCE_SPAN ((uint32_t)1 << (8 * PACKET_SEQUENCE_BYTES)) // packets per hop
+#define PACKET_DIRECTION_OUT 0 // sent by the link's initiator
+#define PACKET_DIRECTION_IN 1  // sent to the link's initiator
+
+inline void implicitNonce(uint64_t epoch, uint64_t hop, uint8_t linkId, uint8_t direction,
+                          uint32_t sequence, uint8_t *nonce) {
+  nonce[0] = (uint8_t)(epoch >> 8);
+  nonce[1] = (uint8_t)epoch;
+  for (int i = 0; i < 5; i++) {
+    nonce[2 + i] = (uint8_t)(hop >> (32 - 8 * i));
+  }
+  nonce[7] = (uint8_t)((linkId << 1) | (direction & 1));
+  nonce[8] = (uint8_t)(sequence >> 24);
+  nonce[9] = (uint8_t)(sequence >> 16);
+  nonce[10] = (uint8_t)(sequence >> 8);
+  nonce[11] = (uint8_t)sequence;
+}
+
+class ImplicitNonce {
+public:
+  ImplicitNonce(uint8_t link, uint8_t linkDirection)
+    : linkId(link & 0x7F), direction(linkDirection), epoch(0), sendHop(0), sent(0) {}
+
+  // New key epoch
+  void setEpoch(uint64_t keyEpoch) {
+    epoch = keyEpoch;
+    sendHop = 0;
+    sent = 0;
+  }
+
+  // Sender: take the next sequence number in this hop and write its nonce
+  // and the PACKET_NONCE_HEADER_BYTES that carry it. Returns false, writing
+  // nothing, once PACKET_SEQUENCE_SPAN packets have gone out in the hop, or
+  // if the hop is behind the last one sent in (after the hop clock is set
+  // back): its sequence numbers may already have been used under this key.
+  bool next(uint64_t hop, uint8_t *nonce, uint8_t *header) {
+    if (hop < sendHop) {
+      return false;
+    }
+    if (hop > sendHop) {
+      sendHop = hop;
+      sent = 0;
+    }
+    if (sent >= PACKET_SEQUENCE_SPAN) {
+      return false;
+    }
+    uint32_t sequence = sent++;
+    implicitNonce(epoch, hop, linkId, direction, sequence, nonce);
+    header[0] = (uint8_t)hop;
+    for (int i = 0; i < PACKET_SEQUENCE_BYTES; i++) {
+      header[PACKET_HOP_CHECK_BYTES + i] =
+        (uint8_t)(sequence >> (8 * (PACKET_SEQUENCE_BYTES - 1 - i)));
+    }
+    return true;
+  }
+
+  // Receiver: read the sequence number from the header bytes and write its
+  // nonce for the hop the packet was received in. Returns false, writing
+  // nothing, if the packet was sent in another hop (a replay).
+  bool expand(uint64_t hop, const uint8_t *header, uint8_t *nonce, uint32_t *sequence) const {
+    if (header[0] != (uint8_t)hop) {
+      return false;
+    }
+    uint32_t value = 0;
+    for (int i = 0; i < PACKET_SEQUENCE_BYTES; i++) {
+      value = (value << 8) | header[PACKET_HOP_CHECK_BYTES + i];
+    }
+    implicitNonce(epoch, hop, linkId, direction, value, nonce);
+    *sequence = value;
+    return true;
+  }
+
+  // Packets sent so far in the current hop
+  uint32_t sentCount() const {
+    return sent;
+  }
+
+private:
+  uint8_t linkId;
+  uint8_t direction;
+  uint64_t epoch;
+  uint64_t sendHop;
+  uint32_t sent;
+};
+
+#endif // IMPLICIT_NONCE_H
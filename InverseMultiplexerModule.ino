@@ -1,24 +1,51 @@
 // Include necessary libraries
 #include <SPI.h>
+#include "AesCtr.h"
+#include "KeyHierarchy.h"
+#include "PacketProtector.h"
 // ... Include other relevant libraries for your RF module and communication protocol.
 
 // Configuration
 #define NUM_CHANNELS 4
 #define MAX_DATA_CHUNK_SIZE 32 // in bytes, modify based on the RF module's capabilities
+#define KEY_EPOCH 0 // Current key epoch, advanced at each rekey
+#define AES_KEY_BITS 128
+
+// Example master TRANSEC key; in a deployment it comes from the key fill
+const uint8_t TRANSEC_MASTER_KEY[MASTER_KEY_LENGTH] = {
+  0x3A, 0x91, 0x5C, 0x07, 0xE2, 0x4F, 0xB8, 0x16, 0x6D, 0xC3, 0x29, 0x80, 0xF5, 0x1B, 0x74, 0xAE,
+  0x02, 0x9D, 0x63, 0xC8, 0x3F, 0xE1, 0x57, 0xBA, 0x48, 0x0C, 0xD6, 0x71, 0x25, 0x9F, 0xEB, 0x34
+};
+
+// Supplies the next plaintext bytes of a message into buffer, at most
+// maxLength of them; returns 0 at the end of the message
+typedef size_t (*PlaintextSource)(byte *buffer, size_t maxLength);
 
 // Function Prototypes
 void splitAndTransmitData(byte *data, unsigned int dataLength);
+bool encryptSplitAndTransmit(PlaintextSource source, const byte *nonce, const byte *header,
+                             unsigned int headerLength);
 void transmitDataChunk(byte *dataChunk, unsigned int chunkSize, unsigned int channel);
 
+PlatformAesCtr aes;
+PacketProtector protector(aes);
+KeyHierarchy keyHierarchy;
+
 void setup() {
   // Initialize communication interfaces (SPI, I2C, etc.)
   // Initialize RF module
   // Initialize the channels/frequencies you will be using for FHSS
+  // Initialize the cipher and key the protector with the epoch's traffic
+  // key; the SAMD51 AES peripheral stays disabled until it has a key
+  keyHierarchy.begin(TRANSEC_MASTER_KEY);
+  aes.begin();
+  protector.setKey(keyHierarchy.subkey(KEY_EPOCH, KEY_PURPOSE_TRAFFIC), AES_KEY_BITS / 8);
 }
 
 void loop() {
   // Your main program logic
-  // When you have data to transmit, call splitAndTransmitData
+  // When you have data to transmit, call splitAndTransmitData, or
+  // encryptSplitAndTransmit to encrypt it on the way out
 }
 
 // Function to split data into chunks and transmit over multiple channels
@@ -38,6 +65,61 @@ void splitAndTransmitData(byte *data, unsigned int dataLength) {
   }
 }
 
+// Encrypt a message as it is produced and send it split into chunks:
+//   [header] [ciphertext] [tag]
+// cut every MAX_DATA_CHUNK_SIZE bytes. Plaintext is pulled from source
+// straight into the chunk buffer and encrypted there (streaming AES-GCM),
+// so the first chunk goes out before the last plaintext byte exists and
+// neither the whole plaintext nor the whole ciphertext is ever held. The
+// header is authenticated, not encrypted, and must fit in the first chunk;
+// returns false, sending nothing, if it does not. The nonce must never
+// repeat under the key (ImplicitNonce.h).
+bool encryptSplitAndTransmit(PlaintextSource source, const byte *nonce, const byte *header,
+                             unsigned int headerLength) {
+  if (headerLength > MAX_DATA_CHUNK_SIZE) {
+    return false;
+  }
+  byte chunk[MAX_DATA_CHUNK_SIZE];
+  unsigned int chunkSize = headerLength;
+  unsigned int currentChannel = 0;
+
+  protector.beginStream(nonce, header, headerLength);
+  memcpy(chunk, header, headerLength);
+
+  while (true) {
+    if (chunkSize == MAX_DATA_CHUNK_SIZE) {
+      transmitDataChunk(chunk, chunkSize, currentChannel);
+      currentChannel = (currentChannel + 1) % NUM_CHANNELS; // Cycle through the channels
+      chunkSize = 0;
+    }
+    size_t plaintextSize = source(chunk + chunkSize, MAX_DATA_CHUNK_SIZE - chunkSize);
+    if (plaintextSize == 0) {
+      break;
+    }
+    protector.encryptStream(chunk + chunkSize, chunk + chunkSize, plaintextSize);
+    chunkSize += plaintextSize;
+  }
+
+  // The tag follows the ciphertext and is split the same way
+  byte tag[PACKET_TAG_SIZE];
+  protector.finishStream(tag);
+  unsigned int tagOffset = 0;
+  while (tagOffset < PACKET_TAG_SIZE) {
+    if (chunkSize == MAX_DATA_CHUNK_SIZE) {
+      transmitDataChunk(chunk, chunkSize, currentChannel);
+      currentChannel = (currentChannel + 1) % NUM_CHANNELS;
+      chunkSize = 0;
+    }
+    unsigned int tagPart = min(PACKET_TAG_SIZE - tagOffset, MAX_DATA_CHUNK_SIZE - chunkSize);
+    memcpy(chunk + chunkSize, tag + tagOffset, tagPart);
+    chunkSize += tagPart;
+    tagOffset += tagPart;
+  }
+  transmitDataChunk(chunk, chunkSize, currentChannel);
+  clean(chunk, sizeof(chunk));
+  return true;
+}
+
 // Function to transmit a chunk of data over a specific channel
 void transmitDataChunk(byte *dataChunk, unsigned int chunkSize, unsigned int channel) {
   // Set the RF module to the appropriate channel
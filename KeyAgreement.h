@@ -0,0 +1,203 @@
+#ifndef KEY_AGREEMENT_H
+#define KEY_AGREEMENT_H
+
+#include <Curve25519.h>
+#include <SHA256.h>
+#include <Crypto.h>
+#include "EntropyPool.h"
+
+// Authenticated ephemeral key agreement between two boards.
+//
+// Each side contributes an ephemeral X25519 key pair. The shared secret is
+// extracted with HMAC-SHA256 keyed by a pairing key that both boards were
+// given ahead of time, over the secret and both public keys:
+//
+//   PRK = HMAC(pairingKey, shared || initiatorPublic || responderPublic)
+//
+// and expanded into a confirmation key and the session key. Each side then
+// proves it derived the same PRK with a tag HMAC(confirmKey, role label),
+// checked in constant time. A third party without the pairing key cannot
+// produce a valid tag, so the exchange is authenticated as well as fresh.
+//
+// Curve25519 from the Crypto library is constant time and has assembly
+// field arithmetic for ARM. A scalar multiplication still takes
+// milliseconds, so EphemeralKeyPool generates key pairs ahead of time from
+// loop() and link setup only pays for the shared secret.
+
+#define X25519_KEY_SIZE 32
+#define KEY_AGREEMENT_TAG_SIZE 32
+#define SESSION_KEY_SIZE 32
+#define EPHEMERAL_POOL_SIZE 4
+
+enum KeyAgreementRole {
+  KEY_AGREEMENT_INITIATOR,
+  KEY_AGREEMENT_RESPONDER
+};
+
+// Compute the public key for a freshly generated private key (clamped here)
+inline void x25519KeyPair(uint8_t *privateKey, uint8_t *publicKey) {
+  privateKey[0] &= 0xF8;
+  privateKey[31] = (privateKey[31] & 0x7F) | 0x40;
+  Curve25519::eval(publicKey, privateKey, 0);
+}
+
+class EphemeralKeyPool {
+public:
+  EphemeralKeyPool(EntropyPool &entropyPool) : entropy(entropyPool), count(0) {}
+
+  // Generate one key pair if there is room and entropy; call while idle.
+  // Returns true if a pair was added.
+  bool refill() {
+    if (count == EPHEMERAL_POOL_SIZE) {
+      return false;
+    }
+    KeyPair &pair = pairs[count];
+    if (!entropy.randomBytes(pair.privateKey, X25519_KEY_SIZE)) {
+      return false;
+    }
+    x25519KeyPair(pair.privateKey, pair.publicKey);
+    count++;
+    return true;
+  }
+
+  // Take a ready key pair; falls back to generating one now if the pool is
+  // empty. Returns false only if no entropy is available.
+  bool take(uint8_t *privateKey, uint8_t *publicKey) {
+    if (count == 0 && !refill()) {
+      return false;
+    }
+    count--;
+    memcpy(privateKey, pairs[count].privateKey, X25519_KEY_SIZE);
+    memcpy(publicKey, pairs[count].publicKey, X25519_KEY_SIZE);
+    clean(&pairs[count], sizeof(KeyPair));
+    return true;
+  }
+
+  uint8_t available() const {
+    return count;
+  }
+
+private:
+  struct KeyPair {
+    uint8_t privateKey[X25519_KEY_SIZE];
+    uint8_t publicKey[X25519_KEY_SIZE];
+  };
+
+  EntropyPool &entropy;
+  KeyPair pairs[EPHEMERAL_POOL_SIZE];
+  uint8_t count;
+};
+
+class KeyAgreement {
+public:
+  KeyAgreement() : established(false), derived(false) {}
+
+  // Start an exchange with our ephemeral key pair, e.g. from EphemeralKeyPool
+  void begin(KeyAgreementRole agreementRole, const uint8_t *pairingKey, const uint8_t *privateKey,
+             const uint8_t *publicKey) {
+    clear();
+    role = agreementRole;
+    memcpy(authKey, pairingKey, sizeof(authKey));
+    memcpy(ourPrivate, privateKey, X25519_KEY_SIZE);
+    memcpy(ourPublic, publicKey, X25519_KEY_SIZE);
+  }
+
+  const uint8_t *publicKey() const {
+    return ourPublic;
+  }
+
+  // Combine with the peer's public key and derive the confirmation and
+  // session keys. Returns false for a peer key that gives the all-zero
+  // shared secret (a small-order point).
+  bool receivePublicKey(const uint8_t *peerPublic) {
+    uint8_t shared[X25519_KEY_SIZE];
+    Curve25519::eval(shared, ourPrivate, peerPublic);
+    clean(ourPrivate, sizeof(ourPrivate));
+
+    uint8_t nonzero = 0;
+    for (int i = 0; i < X25519_KEY_SIZE; i++) {
+      nonzero |= shared[i];
+    }
+    if (nonzero == 0) {
+      clean(shared, sizeof(shared));
+      return false;
+    }
+
+    const uint8_t *initiatorPublic = role == KEY_AGREEMENT_INITIATOR ? ourPublic : peerPublic;
+    const uint8_t *responderPublic = role == KEY_AGREEMENT_INITIATOR ? peerPublic : ourPublic;
+    uint8_t prk[SHA256::HASH_SIZE];
+    hmac.resetHMAC(authKey, sizeof(authKey));
+    hmac.update(shared, sizeof(shared));
+    hmac.update(initiatorPublic, X25519_KEY_SIZE);
+    hmac.update(responderPublic, X25519_KEY_SIZE);
+    hmac.finalizeHMAC(authKey, sizeof(authKey), prk, sizeof(prk));
+    clean(shared, sizeof(shared));
+
+    expand(prk, "FHSS-TRANSEC confirm", confirmKey);
+    expand(prk, "FHSS-TRANSEC session", session);
+    clean(prk, sizeof(prk));
+    derived = true;
+    return true;
+  }
+
+  // Tag to send to the peer
+  void confirmationTag(uint8_t *tag) {
+    computeTag(role, tag);
+  }
+
+  // Check the peer's tag; the session key is only available after this
+  // has succeeded
+  bool verifyConfirmation(const uint8_t *peerTag) {
+    if (!derived) {
+      return false;
+    }
+    uint8_t expected[KEY_AGREEMENT_TAG_SIZE];
+    computeTag(role == KEY_AGREEMENT_INITIATOR ? KEY_AGREEMENT_RESPONDER : KEY_AGREEMENT_INITIATOR,
+               expected);
+    established = secure_compare(expected, peerTag, KEY_AGREEMENT_TAG_SIZE);
+    clean(expected, sizeof(expected));
+    return established;
+  }
+
+  // NULL until the peer's confirmation has been verified
+  const uint8_t *sessionKey() const {
+    return established ? session : NULL;
+  }
+
+  void clear() {
+    clean(authKey, sizeof(authKey));
+    clean(ourPrivate, sizeof(ourPrivate));
+    clean(confirmKey, sizeof(confirmKey));
+    clean(session, sizeof(session));
+    established = false;
+    derived = false;
+  }
+
+private:
+  void expand(const uint8_t *prk, const char *label, uint8_t *out) {
+    static const uint8_t counter = 0x01;
+    hmac.resetHMAC(prk, SHA256::HASH_SIZE);
+    hmac.update(label, strlen(label));
+    hmac.update(&counter, 1);
+    hmac.finalizeHMAC(prk, SHA256::HASH_SIZE, out, SESSION_KEY_SIZE);
+  }
+
+  void computeTag(KeyAgreementRole tagRole, uint8_t *tag) {
+    const char *label = tagRole == KEY_AGREEMENT_INITIATOR ? "initiator" : "responder";
+    hmac.resetHMAC(confirmKey, sizeof(confirmKey));
+    hmac.update(label, strlen(label));
+    hmac.finalizeHMAC(confirmKey, sizeof(confirmKey), tag, KEY_AGREEMENT_TAG_SIZE);
+  }
+
+  SHA256 hmac;
+  KeyAgreementRole role;
+  uint8_t authKey[32];
+  uint8_t ourPrivate[X25519_KEY_SIZE];
+  uint8_t ourPublic[X25519_KEY_SIZE];
+  uint8_t confirmKey[SESSION_KEY_SIZE];
+  uint8_t session[SESSION_KEY_SIZE];
+  bool established;
+  bool derived;
+};
+
+#endif // KEY_AGREEMENT_H
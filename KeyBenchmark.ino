@@ -0,0 +1,194 @@
+#include "CycleCounter.h"
+#include "KeyHierarchy.h"
+#include "KeyAgreement.h"
+#include "KeyWrap.h"
+
+#define DERIVATION_EPOCHS 100
+#define LOOKUPS 100000
+#define AGREEMENT_RUNS 4
+#define WRAP_KEYS 1000
+
+// Fixed example key so runs are comparable between boards
+const uint8_t BENCHMARK_KEY[MASTER_KEY_LENGTH] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+  0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+  0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+
+KeyHierarchy keyHierarchy;
+KeyWrap keyWrap;
+uint8_t plainKeys[WRAP_KEYS][MASTER_KEY_LENGTH];
+uint8_t wrappedKeys[WRAP_KEYS][KEY_WRAP_LENGTH(MASTER_KEY_LENGTH)];
+volatile uint8_t sink; // keeps the compiler from discarding results
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  Serial.println("Key benchmark");
+  benchmarkKeyHierarchy();
+  benchmarkKeyAgreement();
+  benchmarkKeyWrap();
+}
+
+void loop() {
+}
+
+void benchmarkKeyHierarchy() {
+  uint32_t startCycles = cycleCount();
+  keyHierarchy.begin(BENCHMARK_KEY);
+  uint32_t extractCycles = cycleCount() - startCycles;
+
+  // Every epoch is new, so each call derives every subkey
+  startCycles = cycleCount();
+  for (uint32_t epoch = 0; epoch < DERIVATION_EPOCHS; epoch++) {
+    keyHierarchy.prepare(epoch);
+  }
+  uint32_t deriveCycles = cycleCount() - startCycles;
+
+  // Packet path: alternate purposes within the cached epoch
+  uint8_t acc = 0;
+  startCycles = cycleCount();
+  for (uint32_t i = 0; i < LOOKUPS; i++) {
+    acc ^= keyHierarchy.subkey(DERIVATION_EPOCHS - 1, (KeyPurpose)(i % KEY_PURPOSE_COUNT))[0];
+  }
+  uint32_t lookupCycles = cycleCount() - startCycles;
+  sink = acc;
+
+  Serial.print("  HKDF extract (begin): ");
+  Serial.print(extractCycles);
+  Serial.println(" cycles");
+  Serial.print("  per-epoch derivation (");
+  Serial.print(KEY_PURPOSE_COUNT);
+  Serial.print(" subkeys): ");
+  Serial.print(deriveCycles / DERIVATION_EPOCHS);
+  Serial.print(" cycles, ");
+  Serial.print((float)deriveCycles / DERIVATION_EPOCHS / (F_CPU / 1000000), 1);
+  Serial.println(" us");
+  Serial.print("  cached subkey lookup: ");
+  Serial.print((float)lookupCycles / LOOKUPS, 1);
+  Serial.println(" cycles");
+}
+
+// X25519 key agreement. Link setup waits for the initiator's key pair, the
+// responder's key pair and shared secret, then the initiator's shared
+// secret; with pooled key pairs only the two shared secrets remain.
+void benchmarkKeyAgreement() {
+  uint8_t initiatorPrivate[X25519_KEY_SIZE], initiatorPublic[X25519_KEY_SIZE];
+  uint8_t responderPrivate[X25519_KEY_SIZE], responderPublic[X25519_KEY_SIZE];
+  uint8_t initiatorTag[KEY_AGREEMENT_TAG_SIZE], responderTag[KEY_AGREEMENT_TAG_SIZE];
+  uint32_t keyPairCycles = 0, sharedCycles = 0, confirmCycles = 0;
+  bool agreed = true;
+
+  for (int run = 0; run < AGREEMENT_RUNS; run++) {
+    // Fixed, distinct scalars so runs are comparable between boards
+    for (int i = 0; i < X25519_KEY_SIZE; i++) {
+      initiatorPrivate[i] = BENCHMARK_KEY[i] ^ (uint8_t)run;
+      responderPrivate[i] = BENCHMARK_KEY[i] ^ (uint8_t)(0x80 | run);
+    }
+    uint32_t startCycles = cycleCount();
+    x25519KeyPair(initiatorPrivate, initiatorPublic);
+    keyPairCycles += cycleCount() - startCycles;
+    x25519KeyPair(responderPrivate, responderPublic);
+
+    KeyAgreement initiator, responder;
+    initiator.begin(KEY_AGREEMENT_INITIATOR, BENCHMARK_KEY, initiatorPrivate, initiatorPublic);
+    responder.begin(KEY_AGREEMENT_RESPONDER, BENCHMARK_KEY, responderPrivate, responderPublic);
+    startCycles = cycleCount();
+    agreed &= initiator.receivePublicKey(responderPublic);
+    sharedCycles += cycleCount() - startCycles;
+    agreed &= responder.receivePublicKey(initiatorPublic);
+
+    initiator.confirmationTag(initiatorTag);
+    startCycles = cycleCount();
+    responder.confirmationTag(responderTag);
+    agreed &= responder.verifyConfirmation(initiatorTag);
+    confirmCycles += cycleCount() - startCycles;
+    agreed &= initiator.verifyConfirmation(responderTag);
+    agreed &= memcmp(initiator.sessionKey(), responder.sessionKey(), SESSION_KEY_SIZE) == 0;
+  }
+
+  float cyclesPerMs = F_CPU / 1000.0f;
+  float keyPairMs = keyPairCycles / AGREEMENT_RUNS / cyclesPerMs;
+  float sharedMs = sharedCycles / AGREEMENT_RUNS / cyclesPerMs;
+  Serial.print("  X25519 key pair: ");
+  Serial.print(keyPairCycles / AGREEMENT_RUNS);
+  Serial.print(" cycles, ");
+  Serial.print(keyPairMs, 2);
+  Serial.println(" ms");
+  Serial.print("  X25519 shared secret and key derivation: ");
+  Serial.print(sharedCycles / AGREEMENT_RUNS);
+  Serial.print(" cycles, ");
+  Serial.print(sharedMs, 2);
+  Serial.println(" ms");
+  Serial.print("  confirmation tag and check: ");
+  Serial.print(confirmCycles / AGREEMENT_RUNS);
+  Serial.println(" cycles");
+  Serial.print("  link setup compute, fresh key pairs: ");
+  Serial.print(2 * keyPairMs + 2 * sharedMs, 2);
+  Serial.print(" ms, pooled key pairs: ");
+  Serial.print(2 * sharedMs, 2);
+  Serial.println(" ms");
+  Serial.print("  agreement check: ");
+  Serial.println(agreed ? "ok" : "FAILED");
+}
+
+// Wrap and unwrap a bulk key set under one KEK. The cached schedule is
+// expanded once for the whole set; the per-key figures show what setting
+// the KEK again for every key would cost.
+void benchmarkKeyWrap() {
+  for (int k = 0; k < WRAP_KEYS; k++) {
+    for (int i = 0; i < MASTER_KEY_LENGTH; i++) {
+      plainKeys[k][i] = BENCHMARK_KEY[i] ^ (uint8_t)k ^ (uint8_t)(k >> 8);
+    }
+  }
+  uint8_t key[MASTER_KEY_LENGTH];
+  bool unwrapped = true;
+
+  uint32_t startCycles = cycleCount();
+  keyWrap.setKek(BENCHMARK_KEY, MASTER_KEY_LENGTH);
+  for (int k = 0; k < WRAP_KEYS; k++) {
+    keyWrap.wrap(plainKeys[k], MASTER_KEY_LENGTH, wrappedKeys[k]);
+  }
+  uint32_t wrapCycles = cycleCount() - startCycles;
+
+  startCycles = cycleCount();
+  keyWrap.setKek(BENCHMARK_KEY, MASTER_KEY_LENGTH);
+  for (int k = 0; k < WRAP_KEYS; k++) {
+    unwrapped &= keyWrap.unwrap(wrappedKeys[k], sizeof(wrappedKeys[k]), key);
+    unwrapped &= memcmp(key, plainKeys[k], MASTER_KEY_LENGTH) == 0;
+  }
+  uint32_t unwrapCycles = cycleCount() - startCycles;
+
+  startCycles = cycleCount();
+  for (int k = 0; k < WRAP_KEYS; k++) {
+    keyWrap.setKek(BENCHMARK_KEY, MASTER_KEY_LENGTH);
+    unwrapped &= keyWrap.unwrap(wrappedKeys[k], sizeof(wrappedKeys[k]), key);
+  }
+  uint32_t rekeyedCycles = cycleCount() - startCycles;
+  keyWrap.clear();
+  clean(key, sizeof(key));
+
+  Serial.print("  key wrap, ");
+  Serial.print(WRAP_KEYS);
+  Serial.println(" 256-bit keys under an AES-256 KEK:");
+  Serial.print("    wrap, cached KEK: ");
+  Serial.print(wrapCycles / WRAP_KEYS);
+  Serial.print(" cycles/key, ");
+  Serial.print((float)F_CPU / wrapCycles * WRAP_KEYS, 0);
+  Serial.println(" keys/s");
+  Serial.print("    unwrap, cached KEK: ");
+  Serial.print(unwrapCycles / WRAP_KEYS);
+  Serial.print(" cycles/key, ");
+  Serial.print((float)F_CPU / unwrapCycles * WRAP_KEYS, 0);
+  Serial.println(" keys/s");
+  Serial.print("    unwrap, KEK set per key: ");
+  Serial.print(rekeyedCycles / WRAP_KEYS);
+  Serial.print(" cycles/key, ");
+  Serial.print((float)F_CPU / rekeyedCycles * WRAP_KEYS, 0);
+  Serial.println(" keys/s");
+  Serial.print("    unwrap check: ");
+  Serial.println(unwrapped ? "ok" : "FAILED");
+}
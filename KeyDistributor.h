@@ -0,0 +1,331 @@
+#ifndef KEY_DISTRIBUTOR_H
+#define KEY_DISTRIBUTOR_H
+
+#include <Arduino.h>
+#include "KeyFill.h"
+
+// Key distribution to many Slaves on one SPI bus, driven entirely by DMA.
+//
+// begin() builds one chained descriptor list for the transmit channel. For
+// every transaction it holds three descriptors:
+//
+//   1. write the Slave's chip select mask to PORT OUTCLR (select)
+//   2. the key fill frame and two zero pad bytes, to the SERCOM DATA register
+//   3. the same mask written to PORT OUTSET repeatedly (deselect and gap)
+//
+// The descriptors are paced by the SERCOM's data-register-empty trigger, so
+// each PORT write lands when the previous byte has moved to the shift
+// register. The last pad byte is therefore still shifting when slave select
+// rises, and the repeated OUTSET writes wait at least one byte time (and
+// KEY_DISTRIBUTION_GAP_US) before the next Slave is selected, so no Slave
+// sees part of any other byte. The first pad byte arrives whole and is
+// what a Slave's shift register holds if it has not preloaded its answer
+// by its next transaction (SpiSlave.h), so that reads as busy rather than
+// as the last byte of the frame's CRC. A second channel copies every received byte into a
+// buffer, which keeps the receiver from overflowing and captures the status
+// byte each Slave preloads for its next transaction.
+//
+// Frames are interleaved: round r sends key r to every Slave, and a final
+// round polls every Slave once. Each Slave then has all the other Slaves'
+// frames as time to check its own, and the status read at the start of its
+// next transaction tells the master whether it was acknowledged.
+//
+// Slaves that were not acknowledged can be retried with KeyFillMaster,
+// sharing this distributor's KeyFillSequence so the retry never reuses a
+// sequence number whose ACK a Slave may still be holding from the run.
+//
+// The distributor only reaches the DMA channels and the chip select pins
+// through the KeyDistributionBus interface: SpiDmaDistributionBus on the
+// SAMD51, or a simulated bus that replays the descriptor chain against a
+// model of the SERCOM, PORT and the Slaves (KeyDistributorBenchmark.ino).
+
+#define KEY_DISTRIBUTION_MAX_SLAVES 32
+#define KEY_DISTRIBUTION_MAX_KEYS 4  // keys per Slave per run
+#define KEY_DISTRIBUTION_GAP_US 20   // minimum slave select high time
+#define KEY_DISTRIBUTION_PAD_BYTES 2
+#define KEY_DISTRIBUTION_FRAME_SIZE (KEY_FRAME_OVERHEAD + KEY_FILL_KEY_LENGTH)
+#define KEY_DISTRIBUTION_POLL_SIZE 1
+#define KEY_DISTRIBUTION_BUFFER_SIZE \
+  (KEY_DISTRIBUTION_MAX_SLAVES * \
+   (KEY_DISTRIBUTION_MAX_KEYS * (KEY_DISTRIBUTION_FRAME_SIZE + KEY_DISTRIBUTION_PAD_BYTES) + \
+    KEY_DISTRIBUTION_POLL_SIZE + KEY_DISTRIBUTION_PAD_BYTES))
+
+// Two DMA channels paced by one SPI SERCOM, plus the PORT registers of the
+// chip select pins. Every transmit beat, to DATA or to PORT, waits for the
+// SERCOM's data-register-empty trigger; every receive beat takes one byte.
+class KeyDistributionBus {
+public:
+  virtual ~KeyDistributionBus() {}
+  // Start the SERCOM at clockHz and allocate both channels. Returns false
+  // if no channel is free.
+  virtual bool begin(uint32_t clockHz) = 0;
+  // Drive the pin high and return its PORT mask and OUTCLR/OUTSET registers
+  virtual void chipSelect(uint8_t pin, uint32_t *mask, volatile uint32_t **outclr,
+                          volatile uint32_t **outset) = 0;
+  virtual volatile void *dataRegister() = 0;
+  // Append a descriptor to the transmit chain: beats of beatBytes (1 or 4)
+  // to destination. Returns false when descriptor memory has run out.
+  virtual bool addTransmit(const void *source, volatile void *destination, uint16_t beats,
+                           uint8_t beatBytes, bool incrementSource) = 0;
+  virtual bool setReceive(uint8_t *buffer, uint16_t length) = 0;
+  virtual void start() = 0;
+  // True until the receive channel has taken its last byte
+  virtual bool active() = 0;
+  virtual void stop() = 0;
+};
+
+#if defined(__SAMD51__)
+#include <SPI.h>
+#include <Adafruit_ZeroDMA.h>
+
+// The board's SPI SERCOM with two Adafruit_ZeroDMA channels
+class SpiDmaDistributionBus : public KeyDistributionBus {
+public:
+  SpiDmaDistributionBus(SPIClass &spiBus)
+    : spi(spiBus), settings(4000000, MSBFIRST, SPI_MODE0) {}
+
+  bool begin(uint32_t clockHz) {
+    settings = SPISettings(clockHz, MSBFIRST, SPI_MODE0);
+    spi.begin();
+    if (txDma.allocate() != DMA_STATUS_OK || rxDma.allocate() != DMA_STATUS_OK) {
+      return false;
+    }
+    txDma.setTrigger(spi.getDMAC_ID_TX());
+    txDma.setAction(DMA_TRIGGER_ACTON_BEAT);
+    rxDma.setTrigger(spi.getDMAC_ID_RX());
+    rxDma.setAction(DMA_TRIGGER_ACTON_BEAT);
+    return true;
+  }
+
+  void chipSelect(uint8_t pin, uint32_t *mask, volatile uint32_t **outclr,
+                  volatile uint32_t **outset) {
+    const PinDescription &description = g_APinDescription[pin];
+    *mask = 1UL << description.ulPin;
+    *outclr = &PORT->Group[description.ulPort].OUTCLR.reg;
+    *outset = &PORT->Group[description.ulPort].OUTSET.reg;
+    pinMode(pin, OUTPUT);
+    digitalWrite(pin, HIGH);
+  }
+
+  volatile void *dataRegister() {
+    return spi.getDataRegister();
+  }
+
+  bool addTransmit(const void *source, volatile void *destination, uint16_t beats,
+                   uint8_t beatBytes, bool incrementSource) {
+    return txDma.addDescriptor((void *)source, (void *)destination, beats,
+                               beatBytes == 4 ? DMA_BEAT_SIZE_WORD : DMA_BEAT_SIZE_BYTE,
+                               incrementSource, false) != NULL;
+  }
+
+  bool setReceive(uint8_t *buffer, uint16_t length) {
+    return rxDma.addDescriptor(spi.getDataRegister(), buffer, length, DMA_BEAT_SIZE_BYTE,
+                               false, true) != NULL;
+  }
+
+  void start() {
+    spi.beginTransaction(settings);
+    rxDma.startJob();
+    txDma.startJob();
+  }
+
+  bool active() {
+    return rxDma.isActive();
+  }
+
+  void stop() {
+    spi.endTransaction();
+  }
+
+private:
+  SPIClass &spi;
+  SPISettings settings;
+  Adafruit_ZeroDMA txDma;
+  Adafruit_ZeroDMA rxDma;
+};
+#endif
+
+class KeyDistributor {
+public:
+  KeyDistributor(KeyDistributionBus &distributionBus, KeyFillSequence *sharedSequences = NULL)
+    : bus(distributionBus),
+      sequences(sharedSequences != NULL ? *sharedSequences : ownSequences), slaveCount(0),
+      built(false), running(false), byteCount(0), sequenceBase(0), startMicros(0),
+      elapsedMicros(0) {}
+
+  // Add a Slave that receives keyCount keys (KEY_FILL_KEY_LENGTH bytes each,
+  // read from keys at every start()) under ids from firstKeyId. Slaves must
+  // be added before begin().
+  bool addSlave(uint8_t chipSelectPin, uint16_t firstKeyId, const uint8_t *keys,
+                uint8_t keyCount) {
+    if (built || slaveCount == KEY_DISTRIBUTION_MAX_SLAVES || keyCount == 0 ||
+        keyCount > KEY_DISTRIBUTION_MAX_KEYS) {
+      return false;
+    }
+    Slave &slave = slaves[slaveCount++];
+    slave.chipSelectPin = chipSelectPin;
+    slave.firstKeyId = firstKeyId;
+    slave.keys = keys;
+    slave.keyCount = keyCount;
+    slave.acked = 0;
+
+    bus.chipSelect(chipSelectPin, &slave.mask, &slave.outclr, &slave.outset);
+    return true;
+  }
+
+  // Allocate the DMA channels and build the descriptor chain. Returns false
+  // if channels or descriptor memory ran out.
+  bool begin(uint32_t clockHz) {
+    if (!bus.begin(clockHz)) {
+      return false;
+    }
+
+    // Each OUTSET beat takes at least one CPU cycle, so this many beats
+    // cover the gap whatever the bus load
+    uint32_t byteCycles = 8 * (F_CPU / clockHz);
+    uint32_t gapCycles = KEY_DISTRIBUTION_GAP_US * (F_CPU / 1000000);
+    uint32_t gapBeats = gapCycles > byteCycles ? gapCycles : byteCycles;
+    if (gapBeats > 0xFFFF) {
+      gapBeats = 0xFFFF;
+    }
+
+    byteCount = 0;
+    for (int round = 0; round <= KEY_DISTRIBUTION_MAX_KEYS; round++) {
+      for (int s = 0; s < slaveCount; s++) {
+        Slave &slave = slaves[s];
+        if (round > slave.keyCount) {
+          continue;
+        }
+        uint16_t size = round < slave.keyCount ? KEY_DISTRIBUTION_FRAME_SIZE
+                                               : KEY_DISTRIBUTION_POLL_SIZE;
+        slave.offsets[round] = byteCount;
+        if (!addTransaction(slave, size, gapBeats)) {
+          return false;
+        }
+      }
+    }
+    if (!bus.setReceive(rxBuffer, byteCount)) {
+      return false;
+    }
+    built = true;
+    return true;
+  }
+
+  // Encode the current keys and start the transfer; the CPU is free until
+  // finished() returns true
+  void start() {
+    sequenceBase = sequences.take(KEY_DISTRIBUTION_MAX_KEYS);
+    for (int s = 0; s < slaveCount; s++) {
+      Slave &slave = slaves[s];
+      for (int round = 0; round < slave.keyCount; round++) {
+        uint8_t *frame = txBuffer + slave.offsets[round];
+        size_t length = keyFrameEncode(KEY_FRAME_TYPE_KEY, sequence(round),
+                                       slave.firstKeyId + round,
+                                       slave.keys + (size_t)round * KEY_FILL_KEY_LENGTH,
+                                       KEY_FILL_KEY_LENGTH, frame);
+        memset(frame + length, 0, KEY_DISTRIBUTION_PAD_BYTES);
+      }
+      memset(txBuffer + slave.offsets[slave.keyCount], 0,
+             KEY_DISTRIBUTION_POLL_SIZE + KEY_DISTRIBUTION_PAD_BYTES);
+    }
+
+    startMicros = micros();
+    running = true;
+    bus.start();
+  }
+
+  // True once the last transaction has completed; the per-Slave results
+  // are valid from then on
+  bool finished() {
+    if (!running) {
+      return true;
+    }
+    if (bus.active()) {
+      return false;
+    }
+    bus.stop();
+    elapsedMicros = micros() - startMicros;
+    running = false;
+
+    // The status for key r arrives as the first byte of the Slave's next
+    // transaction
+    for (int s = 0; s < slaveCount; s++) {
+      Slave &slave = slaves[s];
+      slave.acked = 0;
+      for (int round = 0; round < slave.keyCount; round++) {
+        uint8_t status = rxBuffer[slave.offsets[round + 1]];
+        if (status == (KEY_FILL_STATUS_ACK | sequence(round))) {
+          slave.acked++;
+        }
+      }
+    }
+    return true;
+  }
+
+  // Number of Slaves added
+  uint8_t size() const {
+    return slaveCount;
+  }
+
+  uint8_t chipSelectPin(uint8_t slave) const {
+    return slaves[slave].chipSelectPin;
+  }
+
+  // Keys the Slave acknowledged in the last run
+  uint8_t ackedKeys(uint8_t slave) const {
+    return slaves[slave].acked;
+  }
+
+  bool slaveSucceeded(uint8_t slave) const {
+    return slaves[slave].acked == slaves[slave].keyCount;
+  }
+
+  // Duration of the last run, from start() to the last byte
+  uint32_t lastRunMicros() const {
+    return elapsedMicros;
+  }
+
+private:
+  struct Slave {
+    uint8_t chipSelectPin;
+    uint16_t firstKeyId;
+    const uint8_t *keys;
+    uint8_t keyCount;
+    uint8_t acked;
+    uint32_t mask;
+    volatile uint32_t *outclr;
+    volatile uint32_t *outset;
+    uint16_t offsets[KEY_DISTRIBUTION_MAX_KEYS + 1]; // transaction starts in the buffers
+  };
+
+  bool addTransaction(Slave &slave, uint16_t size, uint32_t gapBeats) {
+    if (!bus.addTransmit(&slave.mask, slave.outclr, 1, 4, false) ||
+        !bus.addTransmit(txBuffer + byteCount, bus.dataRegister(),
+                         size + KEY_DISTRIBUTION_PAD_BYTES, 1, true) ||
+        !bus.addTransmit(&slave.mask, slave.outset, gapBeats, 4, false)) {
+      return false;
+    }
+    byteCount += size + KEY_DISTRIBUTION_PAD_BYTES;
+    return true;
+  }
+
+  uint8_t sequence(int round) const {
+    return (sequenceBase + round) & KEY_FILL_SEQUENCE_MASK;
+  }
+
+  KeyDistributionBus &bus;
+  KeyFillSequence ownSequences;
+  KeyFillSequence &sequences;
+  Slave slaves[KEY_DISTRIBUTION_MAX_SLAVES];
+  uint8_t slaveCount;
+  bool built;
+  bool running;
+  uint16_t byteCount;
+  uint8_t sequenceBase;
+  unsigned long startMicros;
+  uint32_t elapsedMicros;
+  uint8_t txBuffer[KEY_DISTRIBUTION_BUFFER_SIZE];
+  uint8_t rxBuffer[KEY_DISTRIBUTION_BUFFER_SIZE];
+};
+
+#endif // KEY_DISTRIBUTOR_H
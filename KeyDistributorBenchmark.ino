@@ -0,0 +1,389 @@
+#include "KeyDistributor.h"
+
+// The key distributor on a simulated bus: the sketch replays the DMA
+// descriptor chain the distributor builds, beat by beat, against a model of
+// the SPI SERCOM, the PORT chip select registers and the Slaves, so the
+// chip select framing that rests on the data-register-empty trigger can be
+// checked without a logic analyser. Time is counted in CPU cycles and every
+// DMA beat takes one, the fewest it can, which leaves the least time
+// between bytes and chip select edges. Runs are repeatable.
+//
+// Checks that only one Slave is ever selected, that no Slave sees part of
+// a byte other than the last pad byte, cut off at the end of its transaction,
+// that chip select stays high for KEY_DISTRIBUTION_GAP_US between Slaves,
+// that every byte clocked lands in the receive buffer, and that finished()
+// credits exactly the keys each Slave acknowledged: a Slave that NAKs
+// corrupted frames and one too slow to answer in time get no credit.
+
+#define SLAVES 8
+#define RUNS 4
+#define DISTRIBUTION_CLOCK 8000000
+#define MAX_DESCRIPTORS (3 * KEY_DISTRIBUTION_MAX_SLAVES * (KEY_DISTRIBUTION_MAX_KEYS + 1))
+#define SLAVE_FRAME_SIZE 64
+
+#define FAULT_NONE 0
+#define FAULT_CORRUPT 1 // every second frame arrives with a bit flipped
+#define FAULT_SLOW 2    // never has its answer ready before it is next selected
+
+// A Slave as SpiSlave.h runs it: the status preloaded since it was last
+// deselected is shifted out first when it is selected; if none was, the
+// shift register still holds the last byte received. A frame is checked,
+// and the answer preloaded, in the gap before the Slave is next selected,
+// and a poll preloads the status again
+struct SimulatedSlave {
+  uint8_t fault;
+  bool selected;
+  uint64_t selectCycle;
+  uint8_t frame[SLAVE_FRAME_SIZE];
+  size_t length;
+  uint8_t status;
+  uint8_t out;
+  bool preloaded; // status written since slave select last went high
+  uint32_t framesSeen;
+  uint8_t acks; // ACKs preloaded this run
+  uint8_t keys[KEY_DISTRIBUTION_MAX_KEYS][KEY_FILL_KEY_LENGTH];
+
+  void select(uint64_t cycle) {
+    selected = true;
+    selectCycle = cycle;
+    length = 0;
+    if (preloaded) {
+      out = status;
+    }
+    preloaded = false;
+  }
+
+  // One whole byte each way
+  uint8_t exchange(uint8_t in) {
+    uint8_t sent = out;
+    out = in;
+    if (length < SLAVE_FRAME_SIZE) {
+      frame[length++] = in;
+    }
+    return sent;
+  }
+
+  // Holds a whole frame or poll and all but the last pad byte, so a byte in
+  // flight now is that pad
+  bool complete() const {
+    if (length < KEY_DISTRIBUTION_PAD_BYTES) {
+      return false;
+    }
+    size_t framed = length - (KEY_DISTRIBUTION_PAD_BYTES - 1);
+    for (size_t i = framed; i < length; i++) {
+      if (frame[i] != 0) {
+        return false;
+      }
+    }
+    if (framed == KEY_DISTRIBUTION_POLL_SIZE) {
+      return frame[0] == KEY_FRAME_TYPE_POLL;
+    }
+    return framed >= KEY_FRAME_HEADER_SIZE && framed == (size_t)frame[4] + KEY_FRAME_OVERHEAD;
+  }
+
+  void deselect() {
+    selected = false;
+    if (length < 2 || frame[0] == KEY_FRAME_TYPE_POLL) {
+      preloaded = true;
+      return;
+    }
+    framesSeen++;
+    if (fault == FAULT_CORRUPT && framesSeen % 2 == 0) {
+      frame[KEY_FRAME_HEADER_SIZE] ^= 0x01;
+    }
+    KeyFrame decoded;
+    uint8_t sequence = frame[1] & KEY_FILL_SEQUENCE_MASK;
+    if (keyFrameDecode(frame, length, &decoded) && decoded.type == KEY_FRAME_TYPE_KEY &&
+        decoded.keyId < KEY_DISTRIBUTION_MAX_KEYS && decoded.length == KEY_FILL_KEY_LENGTH) {
+      memcpy(keys[decoded.keyId], decoded.payload, KEY_FILL_KEY_LENGTH);
+      if (fault == FAULT_SLOW) {
+        status = KEY_FILL_STATUS_BUSY;
+        return;
+      }
+      status = KEY_FILL_STATUS_ACK | sequence;
+      acks++;
+    } else {
+      status = KEY_FILL_STATUS_NAK | sequence;
+    }
+    preloaded = true;
+  }
+};
+
+SimulatedSlave slaves[SLAVES];
+
+struct SimulatedDescriptor {
+  const void *source;
+  volatile void *destination;
+  uint16_t beats;
+  uint8_t beatBytes;
+  bool incrementSource;
+};
+
+// The SERCOM has one byte of DATA in front of its shift register, and
+// data-register-empty is set whenever DATA is free
+class SimulatedDistributionBus : public KeyDistributionBus {
+public:
+  SimulatedDistributionBus()
+    : descriptorCount(0), byteCycles(0), rxBuffer(NULL), rxLength(0) {
+    resetStats();
+  }
+
+  bool begin(uint32_t clockHz) {
+    byteCycles = 8 * (F_CPU / clockHz);
+    return true;
+  }
+
+  void chipSelect(uint8_t pin, uint32_t *mask, volatile uint32_t **outclr,
+                  volatile uint32_t **outset) {
+    *mask = 1UL << pin;
+    *outclr = &outclrRegister;
+    *outset = &outsetRegister;
+  }
+
+  volatile void *dataRegister() {
+    return &dataRegisterValue;
+  }
+
+  bool addTransmit(const void *source, volatile void *destination, uint16_t beats,
+                   uint8_t beatBytes, bool incrementSource) {
+    if (descriptorCount == MAX_DESCRIPTORS) {
+      return false;
+    }
+    SimulatedDescriptor &descriptor = descriptors[descriptorCount++];
+    descriptor.source = source;
+    descriptor.destination = destination;
+    descriptor.beats = beats;
+    descriptor.beatBytes = beatBytes;
+    descriptor.incrementSource = incrementSource;
+    return true;
+  }
+
+  bool setReceive(uint8_t *buffer, uint16_t length) {
+    rxBuffer = buffer;
+    rxLength = length;
+    return true;
+  }
+
+  // The whole chain runs here, so finished() sees it done at once
+  void start() {
+    cycle = 0;
+    dataFull = false;
+    shifting = false;
+    rxCount = 0;
+    raised = false;
+    for (int d = 0; d < descriptorCount; d++) {
+      const SimulatedDescriptor &descriptor = descriptors[d];
+      for (uint16_t beat = 0; beat < descriptor.beats; beat++) {
+        // Every beat waits for the trigger, then takes a cycle
+        while (dataFull) {
+          finishByte();
+        }
+        cycle++;
+        while (shifting && shiftEnd <= cycle) {
+          finishByte();
+        }
+        const uint8_t *source = (const uint8_t *)descriptor.source +
+                                (descriptor.incrementSource ? beat * descriptor.beatBytes : 0);
+        if (descriptor.destination == &dataRegisterValue) {
+          data = *source;
+          dataFull = true;
+          if (!shifting) {
+            startByte(cycle);
+          }
+        } else if (descriptor.destination == &outclrRegister) {
+          lower(*(const uint32_t *)source);
+        } else {
+          raise(*(const uint32_t *)source);
+        }
+      }
+    }
+    while (shifting) {
+      finishByte();
+    }
+    lostBytes += rxLength - rxCount; // the receive channel would never finish
+    runCycles += cycle;
+  }
+
+  bool active() {
+    return false;
+  }
+
+  void stop() {
+  }
+
+  void resetStats() {
+    overlaps = 0;
+    cutBytes = 0;
+    cutPads = 0;
+    shortGaps = 0;
+    minGapCycles = UINT32_MAX;
+    lostBytes = 0;
+    transactions = 0;
+    runCycles = 0;
+  }
+
+  int descriptorCount;
+  uint32_t byteCycles;
+  uint32_t overlaps;     // selects while another Slave was selected
+  uint32_t cutBytes;     // bytes a Slave saw only part of, other than pads
+  uint32_t cutPads;      // pad bytes cut off by deselect, as intended
+  uint32_t shortGaps;    // selects less than KEY_DISTRIBUTION_GAP_US after a deselect
+  uint32_t minGapCycles;
+  uint32_t lostBytes;    // bytes clocked with no room in the receive buffer, or missing
+  uint32_t transactions;
+  uint64_t runCycles;
+
+private:
+  void startByte(uint64_t at) {
+    shifting = true;
+    shiftByte = data;
+    dataFull = false;
+    shiftStart = at;
+    shiftEnd = at + byteCycles;
+  }
+
+  // The byte in the shift register completes; a Slave selected for all of
+  // it takes it and answers on MISO
+  void finishByte() {
+    if (cycle < shiftEnd) {
+      cycle = shiftEnd;
+    }
+    uint8_t miso = 0xFF;
+    for (int s = 0; s < SLAVES; s++) {
+      if (slaves[s].selected && slaves[s].selectCycle <= shiftStart) {
+        miso = slaves[s].exchange(shiftByte);
+      }
+    }
+    if (rxCount < rxLength) {
+      rxBuffer[rxCount++] = miso;
+    } else {
+      lostBytes++;
+    }
+    if (dataFull) {
+      startByte(shiftEnd);
+    } else {
+      shifting = false;
+    }
+  }
+
+  void lower(uint32_t mask) {
+    uint64_t gap = cycle - lastRaiseCycle;
+    uint32_t gapCycles = KEY_DISTRIBUTION_GAP_US * (F_CPU / 1000000);
+    shortGaps += raised && gap < gapCycles;
+    if (raised && gap < minGapCycles) {
+      minGapCycles = (uint32_t)gap;
+    }
+    for (int s = 0; s < SLAVES; s++) {
+      if (mask & (1UL << s)) {
+        for (int other = 0; other < SLAVES; other++) {
+          overlaps += slaves[other].selected;
+        }
+        // Selected with a byte already under way: it sees only the tail
+        cutBytes += shifting && shiftStart < cycle;
+        slaves[s].select(cycle);
+        transactions++;
+      }
+    }
+  }
+
+  void raise(uint32_t mask) {
+    for (int s = 0; s < SLAVES; s++) {
+      if (!(mask & (1UL << s)) || !slaves[s].selected) {
+        continue;
+      }
+      if (shifting && slaves[s].selectCycle <= shiftStart) {
+        if (slaves[s].complete() && shiftByte == 0) {
+          cutPads++;
+        } else {
+          cutBytes++;
+        }
+      }
+      slaves[s].deselect();
+      lastRaiseCycle = cycle;
+      raised = true;
+    }
+  }
+
+  SimulatedDescriptor descriptors[MAX_DESCRIPTORS];
+  uint32_t outclrRegister;
+  uint32_t outsetRegister;
+  uint8_t dataRegisterValue;
+  uint8_t *rxBuffer;
+  uint16_t rxLength;
+  uint16_t rxCount;
+  uint64_t cycle;
+  uint64_t lastRaiseCycle;
+  bool raised; // this run
+  uint8_t data;
+  bool dataFull;
+  bool shifting;
+  uint8_t shiftByte;
+  uint64_t shiftStart;
+  uint64_t shiftEnd;
+};
+
+SimulatedDistributionBus simulatedBus;
+KeyDistributor keyDistributor(simulatedBus);
+uint8_t keys[SLAVES][KEY_DISTRIBUTION_MAX_KEYS][KEY_FILL_KEY_LENGTH];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  Serial.println("Key distributor on a simulated bus, " + String(SLAVES) + " slaves, " +
+                 String(DISTRIBUTION_CLOCK / 1000000) + " MHz");
+  slaves[1].fault = FAULT_CORRUPT;
+  slaves[2].fault = FAULT_SLOW;
+  for (int s = 0; s < SLAVES; s++) {
+    // Different key counts, so some rounds skip some Slaves
+    keyDistributor.addSlave(s, 0, keys[s][0], 1 + s % KEY_DISTRIBUTION_MAX_KEYS);
+  }
+  if (!keyDistributor.begin(DISTRIBUTION_CLOCK)) {
+    Serial.println("  descriptor chain did not fit");
+    return;
+  }
+
+  uint32_t acked = 0, credited = 0, wrongCredit = 0, wrongKeys = 0;
+  for (int run = 0; run < RUNS; run++) {
+    for (int s = 0; s < SLAVES; s++) {
+      for (int k = 0; k < KEY_DISTRIBUTION_MAX_KEYS; k++) {
+        for (int i = 0; i < KEY_FILL_KEY_LENGTH; i++) {
+          keys[s][k][i] = (uint8_t)(run * 101 + s * 37 + k * 11 + i);
+        }
+      }
+      slaves[s].acks = 0;
+    }
+    keyDistributor.start();
+    while (!keyDistributor.finished());
+
+    for (int s = 0; s < SLAVES; s++) {
+      acked += slaves[s].acks;
+      credited += keyDistributor.ackedKeys(s);
+      wrongCredit += keyDistributor.ackedKeys(s) != slaves[s].acks;
+      for (int k = 0; k < 1 + s % KEY_DISTRIBUTION_MAX_KEYS && slaves[s].fault == FAULT_NONE;
+           k++) {
+        wrongKeys += memcmp(slaves[s].keys[k], keys[s][k], KEY_FILL_KEY_LENGTH) != 0;
+      }
+    }
+  }
+
+  uint32_t cyclesPerMicro = F_CPU / 1000000;
+  Serial.println("  runs: " + String(RUNS) + ", transactions: " +
+                 String(simulatedBus.transactions) + ", descriptors: " +
+                 String(simulatedBus.descriptorCount) + ", " +
+                 String((unsigned long)(simulatedBus.runCycles / RUNS / cyclesPerMicro)) +
+                 " us per run");
+  Serial.println("  slaves selected together: " + String(simulatedBus.overlaps) +
+                 ", bytes cut: " + String(simulatedBus.cutBytes) + " (pad bytes cut: " +
+                 String(simulatedBus.cutPads) + ")");
+  Serial.println("  shortest chip select gap: " +
+                 String(simulatedBus.minGapCycles / cyclesPerMicro) + " us, " +
+                 String(simulatedBus.shortGaps) + " under " + String(KEY_DISTRIBUTION_GAP_US) +
+                 " us, bytes lost by the receive buffer: " + String(simulatedBus.lostBytes));
+  Serial.println("  keys acknowledged: " + String(acked) + ", credited by finished(): " +
+                 String(credited) + ", slaves credited wrongly: " + String(wrongCredit) +
+                 ", keys stored wrong: " + String(wrongKeys));
+}
+
+void loop() {
+}
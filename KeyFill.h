@@ -0,0 +1,319 @@
+#ifndef KEY_FILL_H
+#define KEY_FILL_H
+
+#include <Arduino.h>
+#include <SPI.h>
+#include "KeyFrame.h"
+
+// Acknowledged key fill from the Master to one or more Slaves over SPI.
+//
+// Keys are wrapped under a key-encryption key before they are handed to the
+// fill, so frames only ever carry wrapped keys.
+//
+// Every key travels in its own KeyFrame with a 6-bit sequence number. The
+// Slave answers with a status byte that the master reads as the first byte
+// of its next transaction:
+//
+//   [code (2 bits)] [sequence (6 bits)]   code: busy, ACK or NAK
+//
+// Fills are pipelined: the master sends frame k+1 while reading the answer
+// to frame k, so a bulk fill costs one transaction per key plus a short
+// drain of status polls at the end. Keys that were NAKed or got no answer
+// are sent again, up to KEY_FILL_MAX_PASSES passes in total.
+//
+// The master reaches the Slave through the KeyFillBus interface:
+// SpiKeyFillBus on an Arduino SPI bus, or a simulated bus that plays the
+// Slave (KeyFillBusBenchmark.ino). The Slave side is in KeyFillSlave.h.
+
+#define KEY_FILL_STATUS_BUSY 0x00
+#define KEY_FILL_STATUS_ACK 0x40
+#define KEY_FILL_STATUS_NAK 0x80
+#define KEY_FILL_STATUS_CODE_MASK 0xC0
+#define KEY_FILL_SEQUENCE_MASK 0x3F
+#define KEY_FILL_SEQUENCES 64
+
+#define KEY_FILL_KEY_LENGTH 40      // a 256-bit key wrapped with RFC 3394 (KeyWrap.h)
+#define KEY_FILL_MAX_KEYS 32       // key table size on the Slave
+#define KEY_FILL_MAX_PASSES 4      // first attempt plus retries
+#define KEY_FILL_FRAME_GAP_US 20   // lets the Slave's loop() keep up
+#define KEY_FILL_POLL_INTERVAL_US 50
+#define KEY_FILL_POLL_LIMIT 100    // polls before a frame counts as lost
+#define KEY_FILL_MAX_RESPONSE 64   // bytes a Slave can return behind an ACK
+#define KEY_FILL_PAD_BYTES 1       // zero after every frame; reads as busy (SpiSlave.h)
+
+// Sequence numbers for everything the Master sends its Slaves, whichever
+// sender it goes through. A Slave's status byte only names a sequence
+// number, so a KeyFillMaster and a KeyDistributor counting on their own can
+// each take a status the other left behind for their own ACK. Senders that
+// talk to the same Slaves share one of these.
+class KeyFillSequence {
+public:
+  KeyFillSequence() : nextSequence(0) {}
+
+  // Reserve count consecutive sequence numbers; returns the first
+  uint8_t take(uint8_t count = 1) {
+    uint8_t first = nextSequence;
+    nextSequence = (nextSequence + count) & KEY_FILL_SEQUENCE_MASK;
+    return first;
+  }
+
+private:
+  uint8_t nextSequence;
+};
+
+struct KeyFillStats {
+  uint32_t framesSent;
+  uint32_t keysAcked;
+  uint32_t naks;     // frames the Slave rejected (CRC or format error)
+  uint32_t lost;     // frames that got no answer
+  uint32_t retries;  // frames sent again
+  uint32_t fillMicros;
+};
+
+// Full-duplex transactions with one Slave: slave select low, length bytes
+// each way (what came back replaces what was sent), slave select high
+class KeyFillBus {
+public:
+  virtual ~KeyFillBus() {}
+  virtual void begin(uint32_t clockHz) = 0;
+  virtual void transfer(uint8_t *data, size_t length) = 0;
+};
+
+// One Slave on an Arduino SPI bus, selected by a GPIO pin
+class SpiKeyFillBus : public KeyFillBus {
+public:
+  SpiKeyFillBus(SPIClass &spiBus, uint8_t chipSelectPin)
+    : spi(spiBus), ssPin(chipSelectPin), settings(4000000, MSBFIRST, SPI_MODE0) {}
+
+  void begin(uint32_t clockHz) {
+    settings = SPISettings(clockHz, MSBFIRST, SPI_MODE0);
+    pinMode(ssPin, OUTPUT);
+    digitalWrite(ssPin, HIGH);
+  }
+
+  void transfer(uint8_t *data, size_t length) {
+    spi.beginTransaction(settings);
+    digitalWrite(ssPin, LOW);
+    spi.transfer(data, length);
+    digitalWrite(ssPin, HIGH);
+    spi.endTransaction();
+  }
+
+private:
+  SPIClass &spi;
+  uint8_t ssPin;
+  SPISettings settings;
+};
+
+class KeyFillMaster {
+public:
+  // Pass the KeyFillSequence shared with any other sender to the same
+  // Slave; without one the master keeps its own
+  KeyFillMaster(KeyFillBus &fillBus, KeyFillSequence *sharedSequences = NULL)
+    : bus(fillBus), sequences(sharedSequences != NULL ? *sharedSequences : ownSequences),
+      lastStatus(KEY_FILL_STATUS_BUSY), acked(NULL) {
+    resetStats();
+  }
+
+  void begin(uint32_t clockHz) {
+    bus.begin(clockHz);
+  }
+
+  bool fill(uint16_t keyId, const uint8_t *key) {
+    uint8_t ackedBits;
+    return fillBulk(keyId, key, 1, &ackedBits) == 1;
+  }
+
+  // Fill count consecutive keys starting at firstKeyId. Bit i of ackedBitmap
+  // is set once key i has been acknowledged. Returns the number acknowledged.
+  uint16_t fillBulk(uint16_t firstKeyId, const uint8_t *keys, uint16_t count,
+                    uint8_t *ackedBitmap) {
+    unsigned long startMicros = micros();
+    memset(ackedBitmap, 0, (count + 7) / 8);
+    acked = ackedBitmap;
+    // A status byte left over from an earlier call is not a duplicate of
+    // anything in this one
+    lastStatus = KEY_FILL_STATUS_BUSY;
+    uint16_t ackedCount = 0;
+
+    // At most KEY_FILL_SEQUENCES frames are in flight at once, so a
+    // sequence number is never reused while an answer to it may still come
+    for (uint16_t start = 0; start < count; start += KEY_FILL_SEQUENCES) {
+      uint16_t end = count - start > KEY_FILL_SEQUENCES ? start + KEY_FILL_SEQUENCES : count;
+      fillBatch(firstKeyId, keys, start, end, &ackedCount);
+    }
+
+    stats.keysAcked += ackedCount;
+    stats.fillMicros += micros() - startMicros;
+    return ackedCount;
+  }
+
+  // Send one frame of the given type and wait for the Slave's answer,
+  // retrying on NAK or timeout. On ACK, responseLength bytes of response
+  // are read back behind the status byte (response may be NULL when that
+  // is 0). Returns false, sending nothing, if responseLength is over
+  // KEY_FILL_MAX_RESPONSE. pollLimit bounds the wait for requests the
+  // Slave takes longer to process.
+  bool request(uint8_t type, uint16_t keyId, const uint8_t *payload, uint8_t length,
+               uint8_t *response, size_t responseLength,
+               uint16_t pollLimit = KEY_FILL_POLL_LIMIT) {
+    if (responseLength > KEY_FILL_MAX_RESPONSE) {
+      return false;
+    }
+    unsigned long startMicros = micros();
+    bool answered = false;
+    for (int pass = 0; pass < KEY_FILL_MAX_PASSES && !answered; pass++) {
+      uint8_t sequence = sequences.take();
+
+      uint8_t frame[KEY_FRAME_MAX_SIZE + KEY_FILL_PAD_BYTES];
+      size_t frameLength = keyFrameEncode(type, sequence, keyId, payload, length, frame);
+      memset(frame + frameLength, 0, KEY_FILL_PAD_BYTES);
+      transfer(frame, frameLength + KEY_FILL_PAD_BYTES);
+      stats.framesSent++;
+      if (pass > 0) {
+        stats.retries++;
+      }
+
+      // Polls clock the status byte and the whole response, so the Slave
+      // never has part of a response left over
+      bool nak = false;
+      for (uint16_t poll = 0; poll < pollLimit && !answered && !nak; poll++) {
+        delayMicroseconds(KEY_FILL_POLL_INTERVAL_US);
+        uint8_t buffer[1 + KEY_FILL_MAX_RESPONSE];
+        memset(buffer, KEY_FRAME_TYPE_POLL, 1 + responseLength);
+        uint8_t status = transfer(buffer, 1 + responseLength);
+        if (status == (KEY_FILL_STATUS_ACK | sequence)) {
+          if (responseLength > 0) {
+            memcpy(response, buffer + 1, responseLength);
+          }
+          answered = true;
+        } else if (status == (KEY_FILL_STATUS_NAK | sequence)) {
+          stats.naks++;
+          nak = true;
+        }
+      }
+      if (!answered && !nak) {
+        stats.lost++;
+      }
+    }
+    stats.fillMicros += micros() - startMicros;
+    return answered;
+  }
+
+  const KeyFillStats &statistics() const {
+    return stats;
+  }
+
+  void resetStats() {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+private:
+  static const uint16_t NO_KEY = 0xFFFF;
+
+  // Keys start..end-1, no more than KEY_FILL_SEQUENCES of them
+  void fillBatch(uint16_t firstKeyId, const uint8_t *keys, uint16_t start, uint16_t end,
+                 uint16_t *ackedCount) {
+    uint16_t batchAcked = 0;
+    for (int pass = 0; pass < KEY_FILL_MAX_PASSES && batchAcked < end - start; pass++) {
+      for (int i = 0; i < KEY_FILL_SEQUENCES; i++) {
+        pendingKey[i] = NO_KEY;
+      }
+      uint16_t sent = 0;
+      uint8_t sequence = 0;
+
+      for (uint16_t i = start; i < end; i++) {
+        if (isAcked(i)) {
+          continue;
+        }
+        sequence = sequences.take();
+        pendingKey[sequence] = i;
+
+        uint8_t frame[KEY_FRAME_MAX_SIZE + KEY_FILL_PAD_BYTES];
+        size_t length = keyFrameEncode(KEY_FRAME_TYPE_KEY, sequence, firstKeyId + i,
+                                       keys + (size_t)i * KEY_FILL_KEY_LENGTH,
+                                       KEY_FILL_KEY_LENGTH, frame);
+        memset(frame + length, 0, KEY_FILL_PAD_BYTES);
+        record(transfer(frame, length + KEY_FILL_PAD_BYTES), &batchAcked);
+        stats.framesSent++;
+        if (pass > 0) {
+          stats.retries++;
+        }
+        sent++;
+        delayMicroseconds(KEY_FILL_FRAME_GAP_US);
+      }
+
+      // Drain: wait for the answer to the last frame of the pass
+      for (int poll = 0; poll < KEY_FILL_POLL_LIMIT && sent > 0; poll++) {
+        uint8_t status = this->poll();
+        record(status, &batchAcked);
+        if ((status & KEY_FILL_SEQUENCE_MASK) == sequence &&
+            (status & KEY_FILL_STATUS_CODE_MASK) != KEY_FILL_STATUS_BUSY) {
+          break;
+        }
+        delayMicroseconds(KEY_FILL_POLL_INTERVAL_US);
+      }
+
+      // NAKed frames are cleared in record(); what is left got no answer
+      for (int i = 0; i < KEY_FILL_SEQUENCES; i++) {
+        if (pendingKey[i] != NO_KEY) {
+          stats.lost++;
+        }
+      }
+    }
+    *ackedCount += batchAcked;
+  }
+
+  // Full-duplex transfer of one frame; returns the Slave's status byte
+  uint8_t transfer(uint8_t *frame, size_t length) {
+    bus.transfer(frame, length);
+    return frame[0];
+  }
+
+  uint8_t poll() {
+    uint8_t status = KEY_FRAME_TYPE_POLL;
+    return transfer(&status, 1);
+  }
+
+  void record(uint8_t status, uint16_t *ackedCount) {
+    // The status byte stays the same until the Slave processes another
+    // frame, so only count each report once
+    if (status == lastStatus) {
+      return;
+    }
+    lastStatus = status;
+    uint8_t sequence = status & KEY_FILL_SEQUENCE_MASK;
+    uint16_t key = pendingKey[sequence];
+    switch (status & KEY_FILL_STATUS_CODE_MASK) {
+      case KEY_FILL_STATUS_ACK:
+        if (key != NO_KEY && !isAcked(key)) {
+          acked[key / 8] |= 1 << (key % 8);
+          (*ackedCount)++;
+        }
+        pendingKey[sequence] = NO_KEY;
+        break;
+      case KEY_FILL_STATUS_NAK:
+        if (key != NO_KEY) {
+          pendingKey[sequence] = NO_KEY; // sent again next pass
+        }
+        stats.naks++;
+        break;
+      default:
+        break;
+    }
+  }
+
+  bool isAcked(uint16_t key) const {
+    return acked[key / 8] & (1 << (key % 8));
+  }
+
+  KeyFillBus &bus;
+  KeyFillSequence ownSequences;
+  KeyFillSequence &sequences;
+  uint8_t lastStatus;
+  uint16_t pendingKey[KEY_FILL_SEQUENCES]; // sequence -> key index in flight this pass
+  uint8_t *acked;
+  KeyFillStats stats;
+};
+
+#endif // KEY_FILL_H
@@ -0,0 +1,137 @@
+#include <SPI.h>
+#include "KeyFill.h"
+#include "KeyDistributor.h"
+
+// Runs on the Master, wired to Slaves running Slave_TRANSEC_Key_Exchange.ino
+// (the Slave's key table takes ids 0 to KEY_FILL_MAX_KEYS - 1). The first
+// Slave in SLAVE_SS_PINS is used for the single-Slave measurements.
+
+#define BULK_ROUNDS 20
+#define SINGLE_FILLS 100
+#define DISTRIBUTION_RUNS 20
+#define DISTRIBUTION_CLOCK 8000000
+
+const uint32_t SPI_CLOCKS[] = {1000000, 4000000, 8000000, 12000000};
+const uint8_t SLAVE_SS_PINS[] = {10, 9, 6, 5};
+#define SLAVE_COUNT (sizeof(SLAVE_SS_PINS) / sizeof(SLAVE_SS_PINS[0]))
+
+uint8_t keys[KEY_FILL_MAX_KEYS][KEY_FILL_KEY_LENGTH];
+uint8_t ackedBitmap[(KEY_FILL_MAX_KEYS + 7) / 8];
+KeyFillSequence keyFillSequences; // shared by every sender, as on the Master
+SpiKeyFillBus slaveBus(SPI, SLAVE_SS_PINS[0]);
+KeyFillMaster keyFill(slaveBus, &keyFillSequences);
+SpiDmaDistributionBus distributionBus(SPI);
+KeyDistributor keyDistributor(distributionBus, &keyFillSequences);
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  // Throwaway key material: only the transfer is being measured
+  for (int i = 0; i < KEY_FILL_MAX_KEYS; i++) {
+    for (int j = 0; j < KEY_FILL_KEY_LENGTH; j++) {
+      keys[i][j] = (uint8_t)(i * 31 + j);
+    }
+  }
+
+  SPI.begin();
+  Serial.println("Key fill benchmark");
+  for (unsigned int c = 0; c < sizeof(SPI_CLOCKS) / sizeof(SPI_CLOCKS[0]); c++) {
+    keyFill.begin(SPI_CLOCKS[c]);
+    Serial.print("SPI clock ");
+    Serial.print(SPI_CLOCKS[c] / 1000000);
+    Serial.println(" MHz:");
+
+    // Stop-and-wait: one key, then poll for its answer
+    keyFill.resetStats();
+    uint32_t filled = 0;
+    for (int i = 0; i < SINGLE_FILLS; i++) {
+      filled += keyFill.fill(i % KEY_FILL_MAX_KEYS, keys[i % KEY_FILL_MAX_KEYS]);
+    }
+    report("single", filled);
+
+    // Pipelined: the whole table per call
+    keyFill.resetStats();
+    filled = 0;
+    for (int i = 0; i < BULK_ROUNDS; i++) {
+      filled += keyFill.fillBulk(0, keys[0], KEY_FILL_MAX_KEYS, ackedBitmap);
+    }
+    report("bulk", filled);
+  }
+
+  benchmarkDistribution();
+}
+
+void loop() {
+}
+
+// All Slaves, KEY_DISTRIBUTION_MAX_KEYS keys each: one Slave after another
+// with blocking transfers, then the whole rack from one DMA descriptor chain
+void benchmarkDistribution() {
+  Serial.print("Distribution to ");
+  Serial.print(SLAVE_COUNT);
+  Serial.print(" slaves, ");
+  Serial.print(KEY_DISTRIBUTION_MAX_KEYS);
+  Serial.print(" keys each, ");
+  Serial.print(DISTRIBUTION_CLOCK / 1000000);
+  Serial.println(" MHz:");
+
+  uint32_t filled = 0;
+  unsigned long startMicros = micros();
+  for (int run = 0; run < DISTRIBUTION_RUNS; run++) {
+    for (unsigned int i = 0; i < SLAVE_COUNT; i++) {
+      SpiKeyFillBus bus(SPI, SLAVE_SS_PINS[i]);
+      KeyFillMaster slaveFill(bus, &keyFillSequences);
+      slaveFill.begin(DISTRIBUTION_CLOCK);
+      filled += slaveFill.fillBulk(0, keys[0], KEY_DISTRIBUTION_MAX_KEYS, ackedBitmap);
+    }
+  }
+  reportDistribution("one slave at a time", filled, micros() - startMicros);
+
+  for (unsigned int i = 0; i < SLAVE_COUNT; i++) {
+    keyDistributor.addSlave(SLAVE_SS_PINS[i], 0, keys[0], KEY_DISTRIBUTION_MAX_KEYS);
+  }
+  if (!keyDistributor.begin(DISTRIBUTION_CLOCK)) {
+    Serial.println("  not enough DMA resources");
+    return;
+  }
+  filled = 0;
+  uint32_t runMicros = 0;
+  for (int run = 0; run < DISTRIBUTION_RUNS; run++) {
+    keyDistributor.start();
+    while (!keyDistributor.finished());
+    runMicros += keyDistributor.lastRunMicros();
+    for (unsigned int i = 0; i < SLAVE_COUNT; i++) {
+      filled += keyDistributor.ackedKeys(i);
+    }
+  }
+  reportDistribution("DMA descriptor chain", filled, runMicros);
+}
+
+void reportDistribution(const char *label, uint32_t filled, unsigned long elapsedMicros) {
+  uint32_t total = (uint32_t)DISTRIBUTION_RUNS * SLAVE_COUNT * KEY_DISTRIBUTION_MAX_KEYS;
+  Serial.print("  ");
+  Serial.print(label);
+  Serial.print(": ");
+  Serial.print((float)filled * 1000000.0f / elapsedMicros, 0);
+  Serial.print(" keys/s, acknowledged ");
+  Serial.print(filled);
+  Serial.print(" of ");
+  Serial.println(total);
+}
+
+void report(const char *label, uint32_t filled) {
+  const KeyFillStats &stats = keyFill.statistics();
+  Serial.print("  ");
+  Serial.print(label);
+  Serial.print(": ");
+  Serial.print((float)filled * 1000000.0f / stats.fillMicros, 0);
+  Serial.print(" keys/s, frames: ");
+  Serial.print(stats.framesSent);
+  Serial.print(", retries: ");
+  Serial.print(stats.retries);
+  Serial.print(", NAKs: ");
+  Serial.print(stats.naks);
+  Serial.print(", lost: ");
+  Serial.println(stats.lost);
+}
@@ -0,0 +1,388 @@
+#include "KeyFillSlave.h"
+
+// The key fill on a simulated SPI bus: the sketch plays the Slave's SERCOM
+// and its DMA channels and calls handleInterrupt() itself when slave select
+// goes high, so the framing and DMA hand-over in SpiSlave.h and
+// KeyFillSlave.h, and KeyFillMaster's retries, can be checked without a
+// board or a logic analyser. Runs are repeatable.
+//
+// On the Slave's side, checks that key frames are handed over whole and
+// answered with the ACK for their sequence number, that status polls are
+// never handed over, that corrupt frames are NAKed and bytes past the
+// buffer dropped, that a frame arriving before loop() has read the
+// previous one is dropped without touching it, and that a response is read
+// back whole behind its ACK.
+//
+// On the master's side, KeyFillMaster::request() runs over a bus that
+// loses and corrupts frames: every answered request must carry its own
+// response, NAKs and lost frames must be retried, and a response longer
+// than KEY_FILL_MAX_RESPONSE must be refused before anything is sent. A
+// bulk fill over a clean bus must have every key acknowledged without a
+// retry.
+
+#define KEY_ROUNDS 200
+#define RESPONSE_LENGTH 32
+#define STATUS_POLLS 4 // polls before a frame counts as unanswered
+#define REQUESTS 200
+#define REQUEST_LENGTH 16
+#define LOST_PERCENT 10    // frames the Slave never sees
+#define CORRUPT_PERCENT 10 // frames with a bit flipped on the way
+
+// SERCOM with PLOADEN: the first byte written to DATA while slave select
+// is high goes straight to the shift register, later ones wait in the
+// one-byte DATA buffer (and are lost if it is full). With DATA empty the
+// shift register sends back the byte it has just received; the master
+// never reads those.
+class SimulatedSpiSlavePort : public SpiSlavePort {
+public:
+  SimulatedSpiSlavePort()
+    : data(0), dataFull(false), shift(0), preloaded(false), rxBuffer(NULL), rxLength(0),
+      rxCount(0), txData(NULL), txLength(0), txCount(0), selectEnded(false), overflows(0) {}
+
+  bool begin(uint8_t *buffer, size_t length) {
+    receive(buffer, length);
+    return true;
+  }
+
+  void setData(uint8_t value) {
+    if (!preloaded) {
+      shift = value;
+      preloaded = true;
+    } else if (!dataFull) {
+      data = value;
+      dataFull = true;
+    }
+    refill();
+  }
+
+  bool takeSelectEnd() {
+    bool ended = selectEnded;
+    selectEnded = false;
+    return ended;
+  }
+
+  size_t stopReceive() {
+    rxLength = 0;
+    txLength = 0;
+    return rxCount;
+  }
+
+  void receive(uint8_t *buffer, size_t length) {
+    rxBuffer = buffer;
+    rxLength = length;
+    rxCount = 0;
+  }
+
+  void transmit(const uint8_t *response, size_t length) {
+    txData = response;
+    txLength = length;
+    txCount = 0;
+    refill();
+  }
+
+  // The master's side: one whole transaction, full duplex
+  void transaction(uint8_t *bytes, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+      uint8_t in = bytes[i];
+      bytes[i] = shift;
+      shift = in;
+      if (rxCount < rxLength) {
+        rxBuffer[rxCount++] = in;
+      } else {
+        overflows++; // left in DATA: BUFOVF
+      }
+      if (dataFull) {
+        shift = data;
+        dataFull = false;
+        refill();
+      }
+    }
+    preloaded = false; // slave select high again
+    selectEnded = true;
+  }
+
+  uint8_t data;
+  bool dataFull;
+  uint8_t shift;
+  bool preloaded;
+  uint8_t *rxBuffer;
+  size_t rxLength;
+  size_t rxCount;
+  const uint8_t *txData;
+  size_t txLength;
+  size_t txCount;
+  bool selectEnded;
+  uint32_t overflows;
+
+private:
+  // The DRE trigger: the transmit channel writes the next response byte
+  // as soon as DATA is empty
+  void refill() {
+    if (!dataFull && txCount < txLength) {
+      data = txData[txCount++];
+      dataFull = true;
+    }
+  }
+};
+
+SimulatedSpiSlavePort simulatedPort;
+SpiSlave spiSlave(simulatedPort);
+KeyFillSlave keyFillSlave(spiSlave);
+KeyFillSequence keyFillSequences; // shared by the sketch's frames and the master
+
+// KeyFillMaster's side of the same Slave. A lost frame never selects the
+// Slave and reads back zeros (MISO idles low); a corrupted one has a bit
+// flipped anywhere after its type byte. The Slave's loop() runs while the
+// master waits between transactions.
+class SimulatedKeyFillBus : public KeyFillBus {
+public:
+  SimulatedKeyFillBus()
+    : lostPercent(0), corruptPercent(0), lostFrames(0), corruptedFrames(0) {}
+
+  void begin(uint32_t clockHz) {
+  }
+
+  void transfer(uint8_t *bytes, size_t length) {
+    bool frame = length > 1 && bytes[0] != KEY_FRAME_TYPE_POLL;
+    if (frame && nextRandom() % 100 < lostPercent) {
+      memset(bytes, 0, length);
+      lostFrames++;
+      return;
+    }
+    if (frame && nextRandom() % 100 < corruptPercent) {
+      bytes[1 + nextRandom() % (length - 1)] ^= 1 << (nextRandom() % 8);
+      corruptedFrames++;
+    }
+    transaction(bytes, length);
+    uint16_t keyId;
+    keyFillSlave.service(&keyId);
+  }
+
+  uint32_t lostPercent;
+  uint32_t corruptPercent;
+  uint32_t lostFrames;
+  uint32_t corruptedFrames;
+};
+
+SimulatedKeyFillBus simulatedBus;
+KeyFillMaster keyFillMaster(simulatedBus, &keyFillSequences);
+uint8_t response[RESPONSE_LENGTH];
+uint32_t randomState = 1;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  Serial.println("Key fill on a simulated SPI bus");
+  spiSlave.begin();
+  keyFillSlave.begin();
+  keyFillSlave.onRequest(handleRequest);
+
+  // Keys: each stored whole and acknowledged by sequence number
+  uint32_t keysAcked = 0, keysWrong = 0, pollsHandedOver = 0;
+  for (int round = 0; round < KEY_ROUNDS; round++) {
+    uint16_t keyId = nextRandom() % KEY_FILL_MAX_KEYS;
+    uint8_t key[KEY_FILL_KEY_LENGTH];
+    for (int i = 0; i < KEY_FILL_KEY_LENGTH; i++) {
+      key[i] = (uint8_t)nextRandom();
+    }
+    uint8_t frameSequence = sendFrame(KEY_FRAME_TYPE_KEY, keyId, key, KEY_FILL_KEY_LENGTH);
+    uint16_t storedId;
+    bool stored = keyFillSlave.service(&storedId) && storedId == keyId;
+    stored &= memcmp(keyFillSlave.key(keyId), key, KEY_FILL_KEY_LENGTH) == 0;
+    keysAcked += waitForStatus(KEY_FILL_STATUS_ACK | frameSequence, 0);
+    keysWrong += !stored;
+
+    // Polls of one byte and of a whole frame's length are not frames
+    uint8_t poll[KEY_FRAME_MAX_SIZE];
+    memset(poll, KEY_FRAME_TYPE_POLL, sizeof(poll));
+    transaction(poll, 1 + nextRandom() % sizeof(poll));
+    pollsHandedOver += keyFillSlave.service(&storedId) || keyFillSlave.frameErrorCount() > 0;
+  }
+  Serial.println("  keys: " + String(KEY_ROUNDS) + ", acknowledged: " + String(keysAcked) +
+                 ", stored wrong: " + String(keysWrong) + ", polls handed over: " +
+                 String(pollsHandedOver));
+
+  // A flipped bit is NAKed. Bytes clocked past the end of the buffer are
+  // dropped; the frame in front of them still arrives.
+  uint8_t key[KEY_FILL_KEY_LENGTH] = {0};
+  uint8_t frame[SPI_SLAVE_BUFFER_SIZE + 16];
+  uint8_t corruptSequence = keyFillSequences.take();
+  size_t length = keyFrameEncode(KEY_FRAME_TYPE_KEY, corruptSequence, 1, key, sizeof(key), frame);
+  frame[KEY_FRAME_HEADER_SIZE] ^= 0x01;
+  memset(frame + length, 0, KEY_FILL_PAD_BYTES);
+  transaction(frame, length + KEY_FILL_PAD_BYTES);
+  uint16_t storedId;
+  keyFillSlave.service(&storedId);
+  bool corruptNaked = waitForStatus(KEY_FILL_STATUS_NAK | corruptSequence, 0);
+  uint8_t longSequence = keyFillSequences.take();
+  length = keyFrameEncode(KEY_FRAME_TYPE_KEY, longSequence, 1, key, sizeof(key), frame);
+  memset(frame + length, 0x5A, sizeof(frame) - length);
+  uint32_t overflows = simulatedPort.overflows;
+  transaction(frame, sizeof(frame));
+  bool longStored = keyFillSlave.service(&storedId) && storedId == 1 &&
+                    waitForStatus(KEY_FILL_STATUS_ACK | longSequence, 0);
+  overflows = simulatedPort.overflows - overflows;
+  Serial.println("  corrupt frame: " + String(corruptNaked ? "NAK" : "FAILED") +
+                 ", frame errors: " + String(keyFillSlave.frameErrorCount()) +
+                 ", overlong transaction: " + String(longStored ? "ACK" : "FAILED") + ", " +
+                 String(overflows) + " bytes past the buffer");
+
+  // Two frames before loop() comes round: the second is dropped and the
+  // first is still whole
+  uint8_t first[KEY_FILL_KEY_LENGTH], second[KEY_FILL_KEY_LENGTH];
+  memset(first, 0x11, sizeof(first));
+  memset(second, 0x22, sizeof(second));
+  uint32_t dropped = spiSlave.droppedFrameCount();
+  uint8_t firstSequence = sendFrame(KEY_FRAME_TYPE_KEY, 2, first, sizeof(first));
+  sendFrame(KEY_FRAME_TYPE_KEY, 3, second, sizeof(second));
+  bool firstKept = keyFillSlave.service(&storedId) && storedId == 2 &&
+                   memcmp(keyFillSlave.key(2), first, sizeof(first)) == 0 &&
+                   waitForStatus(KEY_FILL_STATUS_ACK | firstSequence, 0);
+  dropped = spiSlave.droppedFrameCount() - dropped;
+  Serial.println("  frame while busy: " + String(dropped) + " dropped, first frame " +
+                 (firstKept ? "kept" : "FAILED"));
+
+  // A request's response comes back whole behind its ACK
+  uint8_t requestSequence = sendFrame(KEY_FRAME_TYPE_AGREE_INIT, 0, key, sizeof(key));
+  keyFillSlave.service(&storedId);
+  uint8_t answer[RESPONSE_LENGTH];
+  bool answered = waitForStatus(KEY_FILL_STATUS_ACK | requestSequence, answer);
+  uint8_t expected[RESPONSE_LENGTH];
+  responseFor(key, sizeof(key), expected);
+  bool responseWhole = answered && memcmp(answer, expected, RESPONSE_LENGTH) == 0;
+  Serial.println("  response: " + String(responseWhole ? "read back whole" : "FAILED"));
+
+  benchmarkRequests();
+}
+
+// KeyFillMaster::request() over a lossy bus
+void benchmarkRequests() {
+  Serial.println("Requests from KeyFillMaster, " + String(LOST_PERCENT) + "% of frames lost, " +
+                 String(CORRUPT_PERCENT) + "% corrupted:");
+  simulatedBus.lostPercent = LOST_PERCENT;
+  simulatedBus.corruptPercent = CORRUPT_PERCENT;
+  keyFillMaster.begin(4000000);
+  keyFillMaster.resetStats();
+
+  // Each answer must be the one for its own request, not a stale one
+  uint32_t answered = 0, wrongResponses = 0, confirmed = 0;
+  for (int i = 0; i < REQUESTS; i++) {
+    uint8_t payload[REQUEST_LENGTH], expected[RESPONSE_LENGTH], answer[RESPONSE_LENGTH];
+    for (int j = 0; j < REQUEST_LENGTH; j++) {
+      payload[j] = (uint8_t)nextRandom();
+    }
+    responseFor(payload, REQUEST_LENGTH, expected);
+    if (keyFillMaster.request(KEY_FRAME_TYPE_AGREE_INIT, 0, payload, REQUEST_LENGTH, answer,
+                              RESPONSE_LENGTH)) {
+      answered++;
+      wrongResponses += memcmp(answer, expected, RESPONSE_LENGTH) != 0;
+    }
+    // No response to read back, and none to write to
+    confirmed += keyFillMaster.request(KEY_FRAME_TYPE_AGREE_CONFIRM, 0, payload,
+                                       REQUEST_LENGTH, NULL, 0);
+  }
+  const KeyFillStats &stats = keyFillMaster.statistics();
+  Serial.println("  requests answered: " + String(answered) + " of " + String(REQUESTS) +
+                 ", wrong responses: " + String(wrongResponses) + ", without a response: " +
+                 String(confirmed) + " of " + String(REQUESTS));
+  Serial.println("  frames: " + String(stats.framesSent) + " (" +
+                 String(simulatedBus.lostFrames) + " lost, " +
+                 String(simulatedBus.corruptedFrames) + " corrupted), retries: " +
+                 String(stats.retries) + ", NAKs: " + String(stats.naks) + ", lost: " +
+                 String(stats.lost));
+
+  // Refused up front: nothing is sent and the caller's buffer is untouched
+  uint32_t framesSent = stats.framesSent;
+  uint8_t payload[REQUEST_LENGTH] = {0};
+  uint8_t answer[RESPONSE_LENGTH];
+  bool refused = !keyFillMaster.request(KEY_FRAME_TYPE_AGREE_INIT, 0, payload, REQUEST_LENGTH,
+                                        answer, KEY_FILL_MAX_RESPONSE + 1) &&
+                 stats.framesSent == framesSent;
+  Serial.println("  response over " + String(KEY_FILL_MAX_RESPONSE) + " bytes: " +
+                 (refused ? "refused" : "FAILED"));
+
+  // A bulk fill reads each key's ACK in the next frame it sends, so on a
+  // clean bus every key is acknowledged in the first pass
+  simulatedBus.lostPercent = 0;
+  simulatedBus.corruptPercent = 0;
+  static uint8_t keys[KEY_FILL_MAX_KEYS][KEY_FILL_KEY_LENGTH];
+  for (int k = 0; k < KEY_FILL_MAX_KEYS; k++) {
+    for (int i = 0; i < KEY_FILL_KEY_LENGTH; i++) {
+      keys[k][i] = (uint8_t)nextRandom();
+    }
+  }
+  keyFillMaster.resetStats();
+  uint8_t ackedBits[(KEY_FILL_MAX_KEYS + 7) / 8];
+  uint16_t bulkAcked = keyFillMaster.fillBulk(0, keys[0], KEY_FILL_MAX_KEYS, ackedBits);
+  uint32_t bulkWrong = 0;
+  for (int k = 0; k < KEY_FILL_MAX_KEYS; k++) {
+    bulkWrong += memcmp(keyFillSlave.key(k), keys[k], KEY_FILL_KEY_LENGTH) != 0;
+  }
+  Serial.println("  bulk fill: " + String(bulkAcked) + " of " + String(KEY_FILL_MAX_KEYS) +
+                 " acknowledged, retries: " + String(stats.retries) + ", stored wrong: " +
+                 String(bulkWrong));
+}
+
+void loop() {
+}
+
+uint32_t nextRandom() {
+  randomState = randomState * 1103515245 + 12345;
+  return randomState >> 8;
+}
+
+// What SERCOM1_1_Handler() does on the board
+uint8_t transaction(uint8_t *bytes, size_t length) {
+  simulatedPort.transaction(bytes, length);
+  spiSlave.handleInterrupt();
+  return bytes[0];
+}
+
+uint8_t sendFrame(uint8_t type, uint16_t keyId, const uint8_t *payload, uint8_t length) {
+  uint8_t frame[KEY_FRAME_MAX_SIZE + KEY_FILL_PAD_BYTES];
+  uint8_t frameSequence = keyFillSequences.take();
+  size_t frameLength = keyFrameEncode(type, frameSequence, keyId, payload, length, frame);
+  memset(frame + frameLength, 0, KEY_FILL_PAD_BYTES);
+  transaction(frame, frameLength + KEY_FILL_PAD_BYTES);
+  return frameSequence;
+}
+
+// Poll until the status is expected, clocking a response behind it when
+// answer is given. Returns false if it never came.
+bool waitForStatus(uint8_t expected, uint8_t *answer) {
+  size_t length = answer != NULL ? 1 + RESPONSE_LENGTH : 1;
+  for (int poll = 0; poll < STATUS_POLLS; poll++) {
+    uint8_t buffer[1 + RESPONSE_LENGTH];
+    memset(buffer, KEY_FRAME_TYPE_POLL, length);
+    if (transaction(buffer, length) == expected) {
+      if (answer != NULL) {
+        memcpy(answer, buffer + 1, RESPONSE_LENGTH);
+      }
+      return true;
+    }
+  }
+  return false;
+}
+
+// Depends on the whole payload, so an answer to another request shows
+void responseFor(const uint8_t *payload, uint8_t length, uint8_t *out) {
+  uint32_t crc = crc32(payload, length);
+  for (int i = 0; i < RESPONSE_LENGTH; i++) {
+    out[i] = (uint8_t)(payload[i % length] + (crc >> (8 * (i % 4))));
+  }
+}
+
+// A response for AGREE_INIT, none for AGREE_CONFIRM
+bool handleRequest(const KeyFrame &frame, const uint8_t **responseData, size_t *responseLength) {
+  if (frame.type == KEY_FRAME_TYPE_AGREE_CONFIRM) {
+    return true;
+  }
+  if (frame.type != KEY_FRAME_TYPE_AGREE_INIT || frame.length == 0) {
+    return false;
+  }
+  responseFor(frame.payload, frame.length, response);
+  *responseData = response;
+  *responseLength = RESPONSE_LENGTH;
+  return true;
+}
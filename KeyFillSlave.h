@@ -0,0 +1,90 @@
+#ifndef KEY_FILL_SLAVE_H
+#define KEY_FILL_SLAVE_H
+
+#include "SpiSlave.h"
+#include "KeyFill.h"
+
+// Slave side of the key fill protocol in KeyFill.h: checks each frame that
+// SpiSlave hands over, stores good keys in a table by key id (still wrapped,
+// so they are also wrapped at rest) and answers with an ACK or NAK status
+// byte for the frame's sequence number. Frames of other types go to a
+// request handler, which can return a response for the master to read
+// behind the ACK.
+
+// Returns true to acknowledge the frame. A response set here must stay
+// valid until the master has read it.
+typedef bool (*KeyFillRequestHandler)(const KeyFrame &frame, const uint8_t **response,
+                                      size_t *responseLength);
+
+class KeyFillSlave {
+public:
+  KeyFillSlave(SpiSlave &spiSlave) : slave(spiSlave), requestHandler(NULL), frameErrors(0) {
+    memset(present, 0, sizeof(present));
+  }
+
+  void begin() {
+    slave.setBusyStatus(KEY_FILL_STATUS_BUSY);
+    slave.setStatus(KEY_FILL_STATUS_BUSY);
+  }
+
+  void onRequest(KeyFillRequestHandler handler) {
+    requestHandler = handler;
+  }
+
+  // Process a received frame, if any. Returns true and the key id when a
+  // key was stored.
+  bool service(uint16_t *keyId) {
+    const uint8_t *buffer;
+    size_t length;
+    if (!slave.available(&buffer, &length)) {
+      return false;
+    }
+
+    KeyFrame frame;
+    bool stored = false;
+    bool valid = keyFrameDecode(buffer, length, &frame);
+    uint8_t sequence = frame.sequence & KEY_FILL_SEQUENCE_MASK;
+    if (valid && frame.type != KEY_FRAME_TYPE_KEY && requestHandler != NULL) {
+      const uint8_t *response = NULL;
+      size_t responseLength = 0;
+      if (requestHandler(frame, &response, &responseLength)) {
+        slave.setStatus(KEY_FILL_STATUS_ACK | sequence, response, responseLength);
+      } else {
+        slave.setStatus(KEY_FILL_STATUS_NAK | sequence);
+      }
+    } else if (valid && frame.type == KEY_FRAME_TYPE_KEY && frame.keyId < KEY_FILL_MAX_KEYS &&
+               frame.length == KEY_FILL_KEY_LENGTH) {
+      memcpy(keys[frame.keyId], frame.payload, KEY_FILL_KEY_LENGTH);
+      present[frame.keyId / 8] |= 1 << (frame.keyId % 8);
+      *keyId = frame.keyId;
+      stored = true;
+      slave.setStatus(KEY_FILL_STATUS_ACK | sequence);
+    } else {
+      frameErrors++;
+      slave.setStatus(KEY_FILL_STATUS_NAK | sequence);
+    }
+    slave.release();
+    return stored;
+  }
+
+  bool hasKey(uint16_t keyId) const {
+    return keyId < KEY_FILL_MAX_KEYS && (present[keyId / 8] & (1 << (keyId % 8)));
+  }
+
+  const uint8_t *key(uint16_t keyId) const {
+    return keys[keyId];
+  }
+
+  uint32_t frameErrorCount() const {
+    return frameErrors;
+  }
+
+private:
+  SpiSlave &slave;
+  KeyFillRequestHandler requestHandler;
+  uint8_t keys[KEY_FILL_MAX_KEYS][KEY_FILL_KEY_LENGTH];
+  uint8_t present[(KEY_FILL_MAX_KEYS + 7) / 8];
+  uint32_t frameErrors;
+};
+
+#endif // KEY_FILL_SLAVE_H
@@ -0,0 +1,94 @@
+#ifndef KEY_FRAME_H
+#define KEY_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Frames sent from the Master to the Slave over SPI:
+//
+//   [type (1)] [sequence (1)] [key id (2)] [length (1)] [payload] [CRC-32 (4)]
+//
+// Multi-byte fields are little-endian. The CRC is the IEEE 802.3 CRC-32 over
+// everything before it. The Slave receives a whole frame into a buffer by
+// DMA and checks it once slave select has gone high.
+
+#define KEY_FRAME_TYPE_POLL 0x00          // status read, not a frame (SPI_SLAVE_POLL_BYTE)
+#define KEY_FRAME_TYPE_KEY 0x01           // key for the Slave's key table
+#define KEY_FRAME_TYPE_AGREE_INIT 0x02    // initiator's X25519 public key
+#define KEY_FRAME_TYPE_AGREE_CONFIRM 0x03 // initiator's key confirmation tag
+#define KEY_FRAME_HEADER_SIZE 5
+#define KEY_FRAME_OVERHEAD (KEY_FRAME_HEADER_SIZE + 4)
+#define KEY_FRAME_MAX_PAYLOAD 48
+#define KEY_FRAME_MAX_SIZE (KEY_FRAME_MAX_PAYLOAD + KEY_FRAME_OVERHEAD)
+
+struct KeyFrame {
+  uint8_t type;
+  uint8_t sequence;
+  uint16_t keyId;
+  uint8_t length;
+  const uint8_t *payload; // points into the received buffer
+};
+
+// Nibble-table CRC-32: 64 bytes of table, two lookups per byte
+inline uint32_t crc32Update(uint32_t crc, const uint8_t *data, size_t length) {
+  static const uint32_t table[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC, 0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C, 0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+  };
+  crc = ~crc;
+  for (size_t i = 0; i < length; i++) {
+    crc ^= data[i];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+    crc = (crc >> 4) ^ table[crc & 0x0F];
+  }
+  return ~crc;
+}
+
+inline uint32_t crc32(const uint8_t *data, size_t length) {
+  return crc32Update(0, data, length);
+}
+
+// Writes a frame carrying payload; returns the frame size
+inline size_t keyFrameEncode(uint8_t type, uint8_t sequence, uint16_t keyId,
+                             const uint8_t *payload, uint8_t length, uint8_t *frame) {
+  frame[0] = type;
+  frame[1] = sequence;
+  frame[2] = (uint8_t)keyId;
+  frame[3] = (uint8_t)(keyId >> 8);
+  frame[4] = length;
+  for (uint8_t i = 0; i < length; i++) {
+    frame[KEY_FRAME_HEADER_SIZE + i] = payload[i];
+  }
+  size_t crcOffset = KEY_FRAME_HEADER_SIZE + length;
+  uint32_t crc = crc32(frame, crcOffset);
+  for (int i = 0; i < 4; i++) {
+    frame[crcOffset + i] = (uint8_t)(crc >> (8 * i));
+  }
+  return crcOffset + 4;
+}
+
+// Checks a received frame and fills in out. The sequence number is filled
+// in even when the check fails, so the sender can be told which frame was
+// bad (it is only a hint then).
+inline bool keyFrameDecode(const uint8_t *frame, size_t received, KeyFrame *out) {
+  out->sequence = received > 1 ? frame[1] : 0;
+  if (received < KEY_FRAME_OVERHEAD || frame[4] > KEY_FRAME_MAX_PAYLOAD ||
+      received < (size_t)frame[4] + KEY_FRAME_OVERHEAD) {
+    return false;
+  }
+  size_t crcOffset = KEY_FRAME_HEADER_SIZE + frame[4];
+  uint32_t crc = 0;
+  for (int i = 0; i < 4; i++) {
+    crc |= (uint32_t)frame[crcOffset + i] << (8 * i);
+  }
+  if (crc32(frame, crcOffset) != crc) {
+    return false;
+  }
+  out->type = frame[0];
+  out->keyId = (uint16_t)(frame[2] | (frame[3] << 8));
+  out->length = frame[4];
+  out->payload = frame + KEY_FRAME_HEADER_SIZE;
+  return true;
+}
+
+#endif // KEY_FRAME_H
@@ -0,0 +1,113 @@
+#ifndef KEY_HIERARCHY_H
+#define KEY_HIERARCHY_H
+
+#include <SHA256.h>
+#include <Crypto.h>
+
+// TRANSEC key hierarchy: per-epoch, per-purpose subkeys derived from the
+// master TRANSEC key with HKDF-SHA256 (RFC 5869).
+//
+// The master key is extracted once in begin(). Each subkey is then
+//   HKDF-Expand(PRK, "FHSS-TRANSEC " || purpose || epoch, 32)
+// with the epoch as 8 big-endian bytes. Subkeys are cached for two epochs
+// (slot = epoch & 1, so the current and next epoch never evict each other),
+// which means derivation runs once per epoch and the packet path only does
+// a compare and an array lookup.
+
+#define MASTER_KEY_LENGTH 32
+#define SUBKEY_LENGTH 32
+#define KEY_CACHE_EPOCHS 2
+
+enum KeyPurpose {
+  KEY_PURPOSE_HOP,       // hop sequence key
+  KEY_PURPOSE_TRAFFIC,   // traffic encryption key
+  KEY_PURPOSE_MAC,       // message authentication key
+  KEY_PURPOSE_SYNC_AUTH, // sync packet authentication key
+  KEY_PURPOSE_KEY_WRAP,  // KEK for the next epoch's key sent over the air (Otar.h)
+  KEY_PURPOSE_OTAR_AUTH, // over-the-air rekey packet authentication key (Otar.h)
+  KEY_PURPOSE_COUNT
+};
+
+class KeyHierarchy {
+public:
+  KeyHierarchy() : derivations(0) {
+    invalidate();
+  }
+
+  void begin(const uint8_t *masterKey) {
+    static const char salt[] = "FHSS-TRANSEC key hierarchy";
+    hmac.resetHMAC(salt, sizeof(salt) - 1);
+    hmac.update(masterKey, MASTER_KEY_LENGTH);
+    hmac.finalizeHMAC(salt, sizeof(salt) - 1, prk, sizeof(prk));
+    invalidate();
+  }
+
+  // Subkey for the given epoch and purpose, derived on first use
+  const uint8_t *subkey(uint64_t epoch, KeyPurpose purpose) {
+    EpochKeys &entry = cache[epoch & (KEY_CACHE_EPOCHS - 1)];
+    if (!entry.valid || entry.epoch != epoch) {
+      derive(entry, epoch);
+    }
+    return entry.keys[purpose];
+  }
+
+  // Derive an epoch's subkeys ahead of time, e.g. the next epoch while idle
+  void prepare(uint64_t epoch) {
+    subkey(epoch, KEY_PURPOSE_HOP);
+  }
+
+  // Number of epochs derived so far (cache misses)
+  uint32_t derivationCount() const {
+    return derivations;
+  }
+
+  void clear() {
+    clean(prk, sizeof(prk));
+    clean(cache, sizeof(cache));
+    invalidate();
+  }
+
+private:
+  struct EpochKeys {
+    uint64_t epoch;
+    bool valid;
+    uint8_t keys[KEY_PURPOSE_COUNT][SUBKEY_LENGTH];
+  };
+
+  void invalidate() {
+    for (int i = 0; i < KEY_CACHE_EPOCHS; i++) {
+      cache[i].valid = false;
+    }
+  }
+
+  void derive(EpochKeys &entry, uint64_t epoch) {
+    static const char *const labels[KEY_PURPOSE_COUNT] = {
+      "FHSS-TRANSEC hop", "FHSS-TRANSEC traffic", "FHSS-TRANSEC mac", "FHSS-TRANSEC sync-auth",
+      "FHSS-TRANSEC key-wrap", "FHSS-TRANSEC otar-auth"
+    };
+    uint8_t epochBytes[8];
+    for (int i = 0; i < 8; i++) {
+      epochBytes[i] = (uint8_t)(epoch >> (56 - 8 * i));
+    }
+    // SUBKEY_LENGTH equals the hash length, so HKDF-Expand is the single
+    // block T(1) = HMAC(PRK, info || 0x01)
+    static const uint8_t counter = 0x01;
+    for (int purpose = 0; purpose < KEY_PURPOSE_COUNT; purpose++) {
+      hmac.resetHMAC(prk, sizeof(prk));
+      hmac.update(labels[purpose], strlen(labels[purpose]));
+      hmac.update(epochBytes, sizeof(epochBytes));
+      hmac.update(&counter, 1);
+      hmac.finalizeHMAC(prk, sizeof(prk), entry.keys[purpose], SUBKEY_LENGTH);
+    }
+    entry.epoch = epoch;
+    entry.valid = true;
+    derivations++;
+  }
+
+  SHA256 hmac;
+  uint8_t prk[SHA256::HASH_SIZE];
+  EpochKeys cache[KEY_CACHE_EPOCHS];
+  uint32_t derivations;
+};
+
+#endif // KEY_HIERARCHY_H
@@ -0,0 +1,179 @@
+#ifndef KEY_WRAP_H
+#define KEY_WRAP_H
+
+#include <AES.h>
+#include <Crypto.h>
+
+// AES key wrap (RFC 3394) and key wrap with padding (RFC 5649).
+//
+// TRANSEC keys are only sent or stored wrapped under a key-encryption key
+// (KEK). setKek() expands the KEK schedule once and keeps it, so wrapping or
+// unwrapping a key costs 6 * n block operations and no key expansion, where
+// n is the key length in 64-bit blocks (four for a 256-bit key). Unwrap
+// checks the integrity value in constant time and wipes its output on
+// failure.
+
+#define KEY_WRAP_BLOCK 8
+#define KEY_WRAP_OVERHEAD 8
+#define KEY_WRAP_LENGTH(keyLength) ((((keyLength) + 7) / 8) * 8 + KEY_WRAP_OVERHEAD)
+
+class KeyWrap {
+public:
+  KeyWrap() : cipher(NULL) {}
+
+  // 16, 24 or 32 byte KEK; returns false for other lengths
+  bool setKek(const uint8_t *kek, size_t length) {
+    clear();
+    switch (length) {
+      case 16: cipher = &aes128; break;
+      case 24: cipher = &aes192; break;
+      case 32: cipher = &aes256; break;
+      default: return false;
+    }
+    return cipher->setKey(kek, length);
+  }
+
+  // RFC 3394: length must be a multiple of 8 and at least 16. Writes
+  // length + 8 bytes to out.
+  bool wrap(const uint8_t *key, size_t length, uint8_t *out) {
+    static const uint8_t iv[KEY_WRAP_BLOCK] = {0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6};
+    if (cipher == NULL || length < 16 || length % KEY_WRAP_BLOCK != 0) {
+      return false;
+    }
+    memcpy(out + KEY_WRAP_BLOCK, key, length);
+    wrapBlocks(iv, out, length / KEY_WRAP_BLOCK);
+    return true;
+  }
+
+  // Inverse of wrap(); writes wrappedLength - 8 bytes to key. Returns false
+  // (and zeroes key) if the integrity check fails.
+  bool unwrap(const uint8_t *wrapped, size_t wrappedLength, uint8_t *key) {
+    static const uint8_t iv[KEY_WRAP_BLOCK] = {0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6, 0xA6};
+    if (cipher == NULL || wrappedLength < 24 || wrappedLength % KEY_WRAP_BLOCK != 0) {
+      return false;
+    }
+    size_t length = wrappedLength - KEY_WRAP_OVERHEAD;
+    uint8_t a[KEY_WRAP_BLOCK];
+    unwrapBlocks(wrapped, a, key, length / KEY_WRAP_BLOCK);
+    if (!secure_compare(a, iv, KEY_WRAP_BLOCK)) {
+      clean(key, length);
+      return false;
+    }
+    return true;
+  }
+
+  // RFC 5649: any length from 1 byte. Writes KEY_WRAP_LENGTH(length) bytes.
+  bool wrapPadded(const uint8_t *key, size_t length, uint8_t *out) {
+    if (cipher == NULL || length == 0) {
+      return false;
+    }
+    uint8_t aiv[KEY_WRAP_BLOCK] = {0xA6, 0x59, 0x59, 0xA6, (uint8_t)(length >> 24),
+                                   (uint8_t)(length >> 16), (uint8_t)(length >> 8),
+                                   (uint8_t)length};
+    size_t padded = ((length + 7) / 8) * 8;
+    memcpy(out + KEY_WRAP_BLOCK, key, length);
+    memset(out + KEY_WRAP_BLOCK + length, 0, padded - length);
+    if (padded == KEY_WRAP_BLOCK) {
+      // A single block is encrypted directly with the AIV in front
+      memcpy(out, aiv, KEY_WRAP_BLOCK);
+      cipher->encryptBlock(out, out);
+    } else {
+      wrapBlocks(aiv, out, padded / KEY_WRAP_BLOCK);
+    }
+    return true;
+  }
+
+  // Inverse of wrapPadded(). key needs room for wrappedLength - 8 bytes;
+  // length receives the original key length.
+  bool unwrapPadded(const uint8_t *wrapped, size_t wrappedLength, uint8_t *key, size_t *length) {
+    if (cipher == NULL || wrappedLength < 16 || wrappedLength % KEY_WRAP_BLOCK != 0) {
+      return false;
+    }
+    size_t padded = wrappedLength - KEY_WRAP_OVERHEAD;
+    uint8_t a[KEY_WRAP_BLOCK];
+    if (padded == KEY_WRAP_BLOCK) {
+      uint8_t block[16];
+      cipher->decryptBlock(block, wrapped);
+      memcpy(a, block, KEY_WRAP_BLOCK);
+      memcpy(key, block + KEY_WRAP_BLOCK, KEY_WRAP_BLOCK);
+      clean(block, sizeof(block));
+    } else {
+      unwrapBlocks(wrapped, a, key, padded / KEY_WRAP_BLOCK);
+    }
+
+    // Check the AIV constant, the length range and the zero padding without
+    // branching on any of them separately
+    uint32_t mli = ((uint32_t)a[4] << 24) | ((uint32_t)a[5] << 16) | ((uint32_t)a[6] << 8) | a[7];
+    uint8_t bad = (a[0] ^ 0xA6) | (a[1] ^ 0x59) | (a[2] ^ 0x59) | (a[3] ^ 0xA6);
+    bad |= (mli + KEY_WRAP_BLOCK <= padded) | (mli > padded);
+    if (!bad) {
+      for (size_t i = mli; i < padded; i++) {
+        bad |= key[i];
+      }
+    }
+    if (bad) {
+      clean(key, padded);
+      return false;
+    }
+    *length = mli;
+    return true;
+  }
+
+  void clear() {
+    aes128.clear();
+    aes192.clear();
+    aes256.clear();
+    cipher = NULL;
+  }
+
+private:
+  // out holds room for A followed by the n plaintext blocks already copied
+  // in at out + 8
+  void wrapBlocks(const uint8_t *iv, uint8_t *out, size_t n) {
+    uint8_t b[16];
+    memcpy(b, iv, KEY_WRAP_BLOCK);
+    for (uint32_t j = 0, t = 1; j < 6; j++) {
+      for (size_t i = 1; i <= n; i++, t++) {
+        uint8_t *r = out + KEY_WRAP_BLOCK * i;
+        memcpy(b + KEY_WRAP_BLOCK, r, KEY_WRAP_BLOCK);
+        cipher->encryptBlock(b, b);
+        xorCounter(b, t);
+        memcpy(r, b + KEY_WRAP_BLOCK, KEY_WRAP_BLOCK);
+      }
+    }
+    memcpy(out, b, KEY_WRAP_BLOCK);
+    clean(b, sizeof(b));
+  }
+
+  void unwrapBlocks(const uint8_t *wrapped, uint8_t *a, uint8_t *key, size_t n) {
+    uint8_t b[16];
+    memcpy(b, wrapped, KEY_WRAP_BLOCK);
+    memcpy(key, wrapped + KEY_WRAP_BLOCK, n * KEY_WRAP_BLOCK);
+    for (uint32_t j = 6, t = 6 * n; j > 0; j--) {
+      for (size_t i = n; i >= 1; i--, t--) {
+        uint8_t *r = key + KEY_WRAP_BLOCK * (i - 1);
+        xorCounter(b, t);
+        memcpy(b + KEY_WRAP_BLOCK, r, KEY_WRAP_BLOCK);
+        cipher->decryptBlock(b, b);
+        memcpy(r, b + KEY_WRAP_BLOCK, KEY_WRAP_BLOCK);
+      }
+    }
+    memcpy(a, b, KEY_WRAP_BLOCK);
+    clean(b, sizeof(b));
+  }
+
+  // A ^= t, with t as a 64-bit big-endian counter
+  static void xorCounter(uint8_t *a, uint32_t t) {
+    a[4] ^= (uint8_t)(t >> 24);
+    a[5] ^= (uint8_t)(t >> 16);
+    a[6] ^= (uint8_t)(t >> 8);
+    a[7] ^= (uint8_t)t;
+  }
+
+  AES128 aes128;
+  AES192 aes192;
+  AES256 aes256;
+  BlockCipher *cipher;
+};
+
+#endif // KEY_WRAP_H
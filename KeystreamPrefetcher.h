@@ -0,0 +1,140 @@
+#ifndef KEYSTREAM_PREFETCHER_H
+#define KEYSTREAM_PREFETCHER_H
+
+#include <Crypto.h>
+#include "AesCtr.h"
+#include "PacketProtector.h"
+
+// CTR keystream generated ahead of time for the next packet sequence numbers.
+//
+// The radio spends most of each hop dwell waiting, so loop() calls
+// service() while idle and each call fills one ring slot with the keystream
+// of an upcoming sequence number: E(K, nonce || 1), E(K, nonce || 2), ...
+// This is the GCM layout, so the first block is the tag mask and the rest
+// covers the payload (PacketProtector::protectWithKeystream()). When the
+// packet arrives, keystream() hands out the slot and protecting it is one
+// XOR pass plus GHASH. A sequence number that was not prefetched (a burst,
+// or a jump after packet loss) is generated inline instead and counted as
+// a miss.
+
+#define KEYSTREAM_PREFETCH_PACKETS 8
+#define KEYSTREAM_MAX_PAYLOAD 128
+#define KEYSTREAM_SLOT_SIZE (AES_BLOCK_SIZE + KEYSTREAM_MAX_PAYLOAD)
+
+// Writes the PACKET_NONCE_SIZE byte nonce of a sequence number
+typedef void (*PacketNonceFunction)(uint32_t sequence, uint8_t *nonce);
+
+class KeystreamPrefetcher {
+public:
+  KeystreamPrefetcher(AesCtrCipher &ctrCipher)
+    : cipher(ctrCipher), nonceFor(NULL), nextSequence(0), hits(0), misses(0) {
+    invalidate();
+  }
+
+  // Start prefetching from firstSequence; call again after every rekey
+  void begin(PacketNonceFunction nonceFunction, uint32_t firstSequence) {
+    nonceFor = nonceFunction;
+    nextSequence = firstSequence;
+    clear();
+  }
+
+  // Fill one slot ahead of the next sequence number; call while idle.
+  // Returns false once the ring is full.
+  bool service() {
+    for (uint32_t ahead = 0; ahead < KEYSTREAM_PREFETCH_PACKETS; ahead++) {
+      uint32_t sequence = nextSequence + ahead;
+      Slot &slot = slots[sequence % KEYSTREAM_PREFETCH_PACKETS];
+      if (slot.valid && slot.sequence == sequence) {
+        continue;
+      }
+      generate(sequence, slot.keystream, KEYSTREAM_SLOT_SIZE);
+      slot.sequence = sequence;
+      slot.valid = true;
+      return true;
+    }
+    return false;
+  }
+
+  // Keystream for a packet of payloadLength bytes (at most
+  // KEYSTREAM_MAX_PAYLOAD), starting with the tag mask block. Valid until
+  // the next call.
+  const uint8_t *keystream(uint32_t sequence, size_t payloadLength) {
+    Slot &slot = slots[sequence % KEYSTREAM_PREFETCH_PACKETS];
+    const uint8_t *result;
+    if (slot.valid && slot.sequence == sequence) {
+      hits++;
+      slot.valid = false;
+      result = slot.keystream;
+    } else {
+      misses++;
+      generate(sequence, scratch, AES_BLOCK_SIZE + payloadLength);
+      result = scratch;
+    }
+    // Later slots stay; earlier ones are skipped over
+    if ((int32_t)(sequence + 1 - nextSequence) > 0) {
+      nextSequence = sequence + 1;
+    }
+    return result;
+  }
+
+  // Plain CTR with the prefetched keystream past the tag mask block
+  void crypt(uint32_t sequence, const uint8_t *in, uint8_t *out, size_t length) {
+    const uint8_t *stream = keystream(sequence, length) + AES_BLOCK_SIZE;
+    for (size_t i = 0; i < length; i++) {
+      out[i] = in[i] ^ stream[i];
+    }
+  }
+
+  uint32_t hitCount() const {
+    return hits;
+  }
+
+  uint32_t missCount() const {
+    return misses;
+  }
+
+  void resetStats() {
+    hits = 0;
+    misses = 0;
+  }
+
+  void clear() {
+    clean(slots, sizeof(slots));
+    clean(scratch, sizeof(scratch));
+    invalidate();
+  }
+
+private:
+  struct Slot {
+    uint32_t sequence;
+    bool valid;
+    uint8_t keystream[KEYSTREAM_SLOT_SIZE] __attribute__((aligned(4)));
+  };
+
+  void invalidate() {
+    for (int i = 0; i < KEYSTREAM_PREFETCH_PACKETS; i++) {
+      slots[i].valid = false;
+    }
+  }
+
+  void generate(uint32_t sequence, uint8_t *out, size_t length) {
+    static const uint8_t zero[KEYSTREAM_SLOT_SIZE] = {0};
+    uint8_t counter[AES_BLOCK_SIZE];
+    nonceFor(sequence, counter);
+    counter[12] = 0;
+    counter[13] = 0;
+    counter[14] = 0;
+    counter[15] = 1;
+    cipher.crypt(counter, zero, out, length);
+  }
+
+  AesCtrCipher &cipher;
+  PacketNonceFunction nonceFor;
+  uint32_t nextSequence;
+  uint32_t hits;
+  uint32_t misses;
+  Slot slots[KEYSTREAM_PREFETCH_PACKETS];
+  uint8_t scratch[KEYSTREAM_SLOT_SIZE] __attribute__((aligned(4)));
+};
+
+#endif // KEYSTREAM_PREFETCHER_H
@@ -1,44 +1,154 @@
 // Master.ino
 #include <SPI.h>
+#include "EntropyPool.h"
+#include "KeyFill.h"
+#include "KeyDistributor.h"
+#include "KeyAgreement.h"
+#include "KeyWrap.h"
 
 #define KEY_LENGTH 32
-#define SS_PIN 10
+#define SPI_CLOCK 4000000
+#define TRANSEC_KEY_ID 0 // Slot in the Slave's key table
+#define AGREEMENT_POLL_LIMIT 2000 // The Slave needs an X25519 multiplication to answer
+
+// Shared with the Slaves ahead of time; authenticates the key agreement.
+// Example bytes only: load the real pairing key at provisioning.
+const uint8_t PAIRING_KEY[32] = {
+  0xA5, 0x3C, 0x5E, 0x91, 0x0D, 0x7B, 0x22, 0xE8, 0x4F, 0x16, 0xC3, 0x89, 0x70, 0xBD, 0x2A, 0x5F,
+  0x93, 0x08, 0xE1, 0x6C, 0x47, 0xDA, 0x35, 0xB2, 0x1E, 0x84, 0x6B, 0xF0, 0x59, 0xC7, 0x0A, 0x3D
+};
+
+// One chip select line per Slave on the shared bus
+const uint8_t SLAVE_SS_PINS[] = {10};
+#define SLAVE_COUNT (sizeof(SLAVE_SS_PINS) / sizeof(SLAVE_SS_PINS[0]))
 
 uint8_t TRANSECKey[KEY_LENGTH];
+uint8_t sessionKeys[SLAVE_COUNT][SESSION_KEY_SIZE];
+uint8_t wrappedKeys[SLAVE_COUNT][KEY_FILL_KEY_LENGTH];
+uint8_t distributorSlaves[SLAVE_COUNT]; // slave index for each distributor entry
+EntropyPool entropyPool;
+EphemeralKeyPool keyPool(entropyPool);
+// One sequence counter for everything sent to the slaves, so a retry never
+// reuses a sequence number from the DMA run or the key agreement
+KeyFillSequence keyFillSequences;
+SpiDmaDistributionBus distributionBus(SPI);
+KeyDistributor keyDistributor(distributionBus, &keyFillSequences);
 
 void setup() {
   Serial.begin(115200);
   while (!Serial); // wait for serial port to connect
   
-  // Initialize TRNG
-  MCLK->APBCMASK.bit.TRNG_ = 1;  // enable clock
-  TRNG->CTRLA.bit.ENABLE = 1;    // enable the TRNG
+  // Start collecting TRNG output in the background
+  entropyPool.begin();
   
   // Generate TRANSEC key
-  generateTRANSECKey();
+  if (!generateTRANSECKey()) {
+    Serial.println("TRNG health test failed, no TRANSEC key generated.");
+    while (true);
+  }
 
-  // Setup SPI
+  // Authenticate each slave, agree a session key with it and wrap the
+  // TRANSEC key under that key; only wrapped keys go on the bus
   SPI.begin();
-  pinMode(SS_PIN, OUTPUT);
+  KeyWrap keyWrap;
+  for (unsigned int i = 0; i < SLAVE_COUNT; i++) {
+    String slaveName = "  slave on pin " + String(SLAVE_SS_PINS[i]) + ": ";
+    if (!agreeSessionKey(SLAVE_SS_PINS[i], sessionKeys[i])) {
+      Serial.println(slaveName + "key agreement FAILED, no key sent");
+      continue;
+    }
+    Serial.println(slaveName + "authenticated session key established");
+    keyWrap.setKek(sessionKeys[i], SESSION_KEY_SIZE);
+    keyWrap.wrap(TRANSECKey, KEY_LENGTH, wrappedKeys[i]);
+    distributorSlaves[keyDistributor.size()] = i;
+    keyDistributor.addSlave(SLAVE_SS_PINS[i], TRANSEC_KEY_ID, wrappedKeys[i], 1);
+  }
+  keyWrap.clear();
 
-  // Send TRANSEC key to the slave
-  digitalWrite(SS_PIN, LOW);
-  SPI.transfer(TRANSECKey, KEY_LENGTH);
-  digitalWrite(SS_PIN, HIGH);
-  
-  Serial.println("TRANSEC key sent.");
+  // Send the wrapped keys to every slave back to back by DMA
+  if (!keyDistributor.begin(SPI_CLOCK)) {
+    Serial.println("Not enough DMA resources for key distribution.");
+    while (true);
+  }
+  keyDistributor.start();
+  while (!keyDistributor.finished());
+  Serial.println("TRANSEC key sent to " + String(keyDistributor.size()) + " slaves in " +
+                 String(keyDistributor.lastRunMicros()) + " us.");
+
+  // Retry any slave that did not acknowledge, one at a time
+  for (unsigned int d = 0; d < keyDistributor.size(); d++) {
+    uint8_t i = distributorSlaves[d];
+    String slaveName = "  slave on pin " + String(SLAVE_SS_PINS[i]) + ": ";
+    if (keyDistributor.slaveSucceeded(d)) {
+      Serial.println(slaveName + "acknowledged");
+      continue;
+    }
+    SpiKeyFillBus slaveBus(SPI, SLAVE_SS_PINS[i]);
+    KeyFillMaster keyFill(slaveBus, &keyFillSequences);
+    keyFill.begin(SPI_CLOCK);
+    bool filled = keyFill.fill(TRANSEC_KEY_ID, wrappedKeys[i]);
+    Serial.println(slaveName + (filled ? "acknowledged after retry" : "FAILED"));
+    printFillStats(keyFill);
+  }
 }
 
 void loop() {
+  // Keep ephemeral key pairs ready for the next key agreement
+  keyPool.refill();
 }
 
-void generateTRANSECKey() {
-  for (int i = 0; i < KEY_LENGTH; i++) {
-    TRANSECKey[i] = get_trng() & 0xFF;
+// Run the X25519 key agreement with the slave on ssPin as initiator.
+// Returns false if the slave did not answer or failed authentication.
+bool agreeSessionKey(uint8_t ssPin, uint8_t *sessionKey) {
+  SpiKeyFillBus slaveBus(SPI, ssPin);
+  KeyFillMaster link(slaveBus, &keyFillSequences);
+  link.begin(SPI_CLOCK);
+
+  uint8_t privateKey[X25519_KEY_SIZE];
+  uint8_t publicKey[X25519_KEY_SIZE];
+  if (!keyPool.take(privateKey, publicKey)) {
+    return false;
   }
+  KeyAgreement agreement;
+  agreement.begin(KEY_AGREEMENT_INITIATOR, PAIRING_KEY, privateKey, publicKey);
+  clean(privateKey, sizeof(privateKey));
+
+  // The slave answers with its public key and confirmation tag
+  uint8_t response[X25519_KEY_SIZE + KEY_AGREEMENT_TAG_SIZE];
+  bool agreed = link.request(KEY_FRAME_TYPE_AGREE_INIT, 0, publicKey, X25519_KEY_SIZE, response,
+                             sizeof(response), AGREEMENT_POLL_LIMIT) &&
+                agreement.receivePublicKey(response) &&
+                agreement.verifyConfirmation(response + X25519_KEY_SIZE);
+  if (agreed) {
+    uint8_t tag[KEY_AGREEMENT_TAG_SIZE];
+    agreement.confirmationTag(tag);
+    agreed = link.request(KEY_FRAME_TYPE_AGREE_CONFIRM, 0, tag, sizeof(tag), NULL, 0);
+  }
+  if (agreed) {
+    memcpy(sessionKey, agreement.sessionKey(), SESSION_KEY_SIZE);
+  }
+  agreement.clear();
+  return agreed;
+}
+
+// Returns false if the TRNG failed its health tests
+bool generateTRANSECKey() {
+  // Only waits for the first pool fill; after that this returns at once
+  while (!entropyPool.randomBytes(TRANSECKey, KEY_LENGTH)) {
+    if (entropyPool.healthAlarm()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void printFillStats(const KeyFillMaster &keyFill) {
+  const KeyFillStats &stats = keyFill.statistics();
+  Serial.println("    fill time: " + String(stats.fillMicros) + " us, frames: " +
+                 String(stats.framesSent) + ", retries: " + String(stats.retries) +
+                 ", NAKs: " + String(stats.naks) + ", lost: " + String(stats.lost));
 }
 
-uint32_t get_trng() {
-  while ((TRNG->INTFLAG.reg & TRNG_INTFLAG_MASK) == 0);
-  return (TRNG->DATA.reg);
+void TRNG_Handler() {
+  entropyPool.handleInterrupt();
 }
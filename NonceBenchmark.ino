@@ -0,0 +1,134 @@
+#include "CycleCounter.h"
+#include "ImplicitNonce.h"
+#include "PacketProtector.h"
+
+// Payload per RF packet with the IV sent explicitly against implicit
+// nonces, and the cost of building a nonce on each side.
+
+#define HEADER_SIZE 2 // address and flags
+#define EXPLICIT_IV_SIZE 16 // the AES block-sized IV sent with each message before
+#define NONCE_RUNS 10000
+
+const size_t PACKET_SIZES[] = {32, 48, 64, 128, 255};
+
+ImplicitNonce senderNonces(1, PACKET_DIRECTION_OUT);
+ImplicitNonce receiverNonces(1, PACKET_DIRECTION_OUT);
+volatile uint8_t sink; // keeps the compiler from discarding results
+uint64_t firstFreeHop = 1000000; // each run sends in hops after the last run's
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  Serial.println("Implicit nonce benchmark");
+  Serial.println("  payload bytes per packet (" + String(PACKET_TAG_SIZE) + "-byte tag):");
+  Serial.println("  packet  16-byte IV  12-byte nonce  implicit  gain over IV");
+  for (unsigned int i = 0; i < sizeof(PACKET_SIZES) / sizeof(PACKET_SIZES[0]); i++) {
+    int packet = PACKET_SIZES[i];
+    int overhead = HEADER_SIZE + PACKET_TAG_SIZE;
+    int withIv = packet - overhead - EXPLICIT_IV_SIZE;
+    int withNonce = packet - overhead - PACKET_NONCE_SIZE;
+    int implicit = packet - overhead - PACKET_NONCE_HEADER_BYTES;
+    Serial.print("  ");
+    Serial.print(packet);
+    Serial.print("  ");
+    Serial.print(withIv > 0 ? String(withIv) : String("none"));
+    Serial.print("  ");
+    Serial.print(withNonce > 0 ? String(withNonce) : String("none"));
+    Serial.print("  ");
+    Serial.print(implicit);
+    if (withIv > 0) {
+      Serial.print("  +");
+      Serial.print(100.0f * (implicit - withIv) / withIv, 1);
+      Serial.println("%");
+    } else {
+      Serial.println("  only fits without the IV");
+    }
+  }
+
+  // Nonce construction: sender counts, receiver reads the sequence number
+  senderNonces.setEpoch(7);
+  receiverNonces.setEpoch(7);
+  Serial.println("  nonce build cycles (sender, receiver), received nonces that match,");
+  Serial.println("  packets refused over the " + String(PACKET_SEQUENCE_SPAN) + " per hop limit:");
+  benchmarkNonces("1 in 3 lost, 16 per hop", 16, everyThirdLost);
+  benchmarkNonces("200-packet bursts lost, 250 per hop", 250, burstLost);
+  benchmarkNonces("300 offered per hop", 300, noneLost);
+  checkHopSetBack();
+}
+
+void loop() {
+}
+
+bool noneLost(uint32_t i) {
+  return false;
+}
+
+
+bool everyThirdLost(uint32_t i) {
+  return i % 3 == 1;
+}
+
+// Fades that drop 200 packets in a row: one inside a hop, one across a
+// hop boundary
+bool burstLost(uint32_t i) {
+  return (i >= 20 && i < 220) || (i >= 400 && i < 600);
+}
+
+void benchmarkNonces(const char *pattern, uint32_t packetsPerHop, bool (*lost)(uint32_t)) {
+  uint8_t nonce[PACKET_NONCE_SIZE], received[PACKET_NONCE_SIZE];
+  uint8_t header[PACKET_NONCE_HEADER_BYTES];
+  uint32_t senderCycles = 0, receiverCycles = 0;
+  uint32_t delivered = 0, matched = 0, refused = 0;
+  for (uint32_t i = 0; i < NONCE_RUNS; i++) {
+    uint64_t hop = firstFreeHop + i / packetsPerHop;
+    uint32_t startCycles = cycleCount();
+    bool sent = senderNonces.next(hop, nonce, header);
+    senderCycles += cycleCount() - startCycles;
+    if (!sent) {
+      refused++;
+      continue;
+    }
+    if (lost(i)) {
+      continue; // lost on the air
+    }
+    startCycles = cycleCount();
+    uint32_t sequence;
+    receiverNonces.expand(hop, header, received, &sequence);
+    receiverCycles += cycleCount() - startCycles;
+    delivered++;
+    matched += memcmp(nonce, received, PACKET_NONCE_SIZE) == 0;
+    sink = received[11];
+  }
+  firstFreeHop += (NONCE_RUNS + packetsPerHop - 1) / packetsPerHop;
+  Serial.print("    ");
+  Serial.print(pattern);
+  Serial.print(": ");
+  Serial.print((float)senderCycles / NONCE_RUNS, 1);
+  Serial.print(", ");
+  Serial.print((float)receiverCycles / delivered, 1);
+  Serial.print(", ");
+  Serial.print(matched);
+  Serial.print("/");
+  Serial.print(delivered);
+  Serial.print(", ");
+  Serial.print(refused);
+  Serial.println(matched == delivered ? "" : "  MISMATCH");
+}
+
+// The hop clock set back mid-hop (a resync): the earlier hop and the rest of
+// the current one must not hand out a sequence number a second time
+void checkHopSetBack() {
+  uint8_t nonce[PACKET_NONCE_SIZE], header[PACKET_NONCE_HEADER_BYTES];
+  bool ok = true;
+  for (int i = 0; i < 5; i++) {
+    ok &= senderNonces.next(firstFreeHop, nonce, header);
+  }
+  ok &= !senderNonces.next(firstFreeHop - 1, nonce, header); // behind: refused
+  const uint8_t *sequence = header + PACKET_HOP_CHECK_BYTES;
+  ok &= senderNonces.next(firstFreeHop, nonce, header) && sequence[0] == 5; // carries on
+  ok &= senderNonces.next(firstFreeHop + 1, nonce, header) && sequence[0] == 0;
+  ok &= !senderNonces.next(firstFreeHop, nonce, header);
+  Serial.println(ok ? "  hop set back: refused" : "  hop set back: NONCE REUSED");
+}
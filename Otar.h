@@ -0,0 +1,351 @@
+#ifndef OTAR_H
+#define OTAR_H
+
+#include <Crypto.h>
+#include "KeyHierarchy.h"
+#include "KeyWrap.h"
+#include "PacketAuthenticator.h"
+
+// Over-the-air rekey (OTAR) over the FHSS data link.
+//
+// The next epoch's master key is sent wrapped (RFC 3394, KeyWrap.h) under
+// the current epoch's KEY_PURPOSE_KEY_WRAP subkey, together with the epoch
+// it becomes and the hop it takes effect at:
+//
+//   wrap(KEK, key (32) || activation hop (8) || epoch (8))   -> 56 bytes
+//
+// Hop and epoch are big-endian and inside the wrap, so its integrity check
+// covers them as well as the key. The 56 bytes are split into fragments
+// that fit one link packet:
+//
+//   fragment: [OTAR_PACKET_FRAGMENT] [rekey id] [index] [count] [data] [tag]
+//   ack:      [OTAR_PACKET_ACK] [rekey id] [bitmap of fragments held] [tag]
+//
+// The rekey id is the low byte of the new epoch. The tag is OTAR_TAG_SIZE
+// bytes of HMAC-SHA256 (PacketAuthenticator.h) over the rest of the packet
+// under the current epoch's KEY_PURPOSE_OTAR_AUTH subkey, so only a node
+// holding the current key can send fragments or acks. A forged ack cannot
+// end a rekey, a forged fragment cannot make the receiver drop the ones it
+// holds, and a data packet that happens to start with an OTAR type byte
+// fails the tag and is left to the data path. OTAR is low-priority
+// traffic: the link asks OtarSender for a packet only in slots its own data
+// leaves free. The receiver acks every fragment with everything it holds,
+// so one lost ack is repaired by the next; the sender goes round the
+// unacked fragments again after OTAR_RETRY_MS without an ack.
+//
+// The whole message is also checked by the key wrap. If it fails to unwrap
+// (a peer on another key, say) the receiver drops everything it held. The
+// ack bitmap therefore only reports all fragments once the unwrap has
+// succeeded, and the sender takes each ack as the receiver's current
+// holdings rather than adding it to earlier ones: after a failed unwrap the
+// next ack shows the fragments as missing again and the sender resends
+// them.
+
+#define OTAR_PACKET_SIZE 32 // link packet size (MAX_DATA_CHUNK_SIZE)
+#define OTAR_PACKET_FRAGMENT 0xF0
+#define OTAR_PACKET_ACK 0xF1
+#define OTAR_FRAGMENT_HEADER 4
+#define OTAR_TAG_SIZE 8
+#define OTAR_ACK_SIZE (3 + OTAR_TAG_SIZE)
+#define OTAR_KEY_LENGTH MASTER_KEY_LENGTH
+#define OTAR_PLAIN_LENGTH (OTAR_KEY_LENGTH + 16)
+#define OTAR_MESSAGE_LENGTH KEY_WRAP_LENGTH(OTAR_PLAIN_LENGTH)
+#define OTAR_FRAGMENT_DATA (OTAR_PACKET_SIZE - OTAR_FRAGMENT_HEADER - OTAR_TAG_SIZE)
+#define OTAR_FRAGMENTS ((OTAR_MESSAGE_LENGTH + OTAR_FRAGMENT_DATA - 1) / OTAR_FRAGMENT_DATA)
+#define OTAR_RETRY_MS 200
+#define OTAR_MAX_ROUNDS 50 // give up after this many passes over the fragments
+
+#if OTAR_FRAGMENTS > 8
+#error "OTAR_PACKET_SIZE too small: the ack bitmap holds 8 fragments"
+#endif
+
+struct OtarStats {
+  uint32_t fragmentsSent;
+  uint32_t retransmissions;
+  uint32_t acksSent;
+  uint32_t acksReceived;
+  uint32_t bytesSent;      // all OTAR bytes put on the air by this node
+  uint32_t rejected;       // messages that failed the key wrap check
+  uint32_t forged;         // packets that failed the tag check
+};
+
+class OtarSender {
+public:
+  OtarSender() : state(OTAR_IDLE) {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  // Start sending key as the master key of epoch from activationHop on,
+  // wrapped under kek (the current epoch's KEY_PURPOSE_KEY_WRAP subkey) and
+  // authenticated under authKey (its KEY_PURPOSE_OTAR_AUTH subkey)
+  void begin(const uint8_t *kek, const uint8_t *authKey, const uint8_t *key, uint64_t epoch,
+             uint64_t activationHop) {
+    uint8_t plain[OTAR_PLAIN_LENGTH];
+    memcpy(plain, key, OTAR_KEY_LENGTH);
+    for (int i = 0; i < 8; i++) {
+      plain[OTAR_KEY_LENGTH + i] = (uint8_t)(activationHop >> (56 - 8 * i));
+      plain[OTAR_KEY_LENGTH + 8 + i] = (uint8_t)(epoch >> (56 - 8 * i));
+    }
+    KeyWrap keyWrap;
+    keyWrap.setKek(kek, SUBKEY_LENGTH);
+    keyWrap.wrap(plain, sizeof(plain), message);
+    keyWrap.clear();
+    clean(plain, sizeof(plain));
+    authenticator.begin(authKey, SUBKEY_LENGTH, OTAR_TAG_SIZE);
+
+    rekeyId = (uint8_t)epoch;
+    acked = 0;
+    sentThisRound = 0;
+    rounds = 1;
+    waitingSince = 0;
+    waiting = false;
+    state = OTAR_SENDING;
+  }
+
+  // Fills packet with the next fragment to send in a free slot. Returns its
+  // length, or 0 if OTAR has nothing to send now.
+  size_t nextPacket(uint8_t *packet, uint32_t nowMillis) {
+    if (state != OTAR_SENDING) {
+      return 0;
+    }
+    uint8_t pending = (uint8_t)(ALL_FRAGMENTS & ~acked & ~sentThisRound);
+    if (pending == 0) {
+      // Round done: wait for acks, then resend whatever is still missing
+      if (!waiting) {
+        waiting = true;
+        waitingSince = nowMillis;
+        return 0;
+      }
+      if (nowMillis - waitingSince < OTAR_RETRY_MS) {
+        return 0;
+      }
+      if (++rounds > OTAR_MAX_ROUNDS) {
+        state = OTAR_FAILED;
+        return 0;
+      }
+      sentThisRound = acked;
+      waiting = false;
+      pending = (uint8_t)(ALL_FRAGMENTS & ~acked);
+      stats.retransmissions += popcount(pending);
+    }
+
+    uint8_t index = 0;
+    while (!(pending & (1 << index))) {
+      index++;
+    }
+    size_t offset = index * OTAR_FRAGMENT_DATA;
+    size_t length = OTAR_MESSAGE_LENGTH - offset;
+    if (length > OTAR_FRAGMENT_DATA) {
+      length = OTAR_FRAGMENT_DATA;
+    }
+    packet[0] = OTAR_PACKET_FRAGMENT;
+    packet[1] = rekeyId;
+    packet[2] = index;
+    packet[3] = OTAR_FRAGMENTS;
+    memcpy(packet + OTAR_FRAGMENT_HEADER, message + offset, length);
+    length = authenticator.seal(packet, OTAR_FRAGMENT_HEADER + length);
+    sentThisRound |= 1 << index;
+    stats.fragmentsSent++;
+    stats.bytesSent += length;
+    return length;
+  }
+
+  // Pass received packets that may be OTAR acks here. Returns true if the
+  // packet was an authentic ack for this rekey; anything else is left to
+  // the data path. finished() turns true once the receiver has acknowledged
+  // the whole message, which it only does after the message has passed the
+  // key wrap check.
+  bool handlePacket(const uint8_t *packet, size_t length) {
+    if (state != OTAR_SENDING || length != OTAR_ACK_SIZE || packet[0] != OTAR_PACKET_ACK ||
+        packet[1] != rekeyId) {
+      return false;
+    }
+    if (authenticator.open(packet, length) < 0) {
+      stats.forged++;
+      return false;
+    }
+    stats.acksReceived++;
+    // What the receiver holds now; it may have dropped fragments it acked
+    // before, if they did not unwrap
+    acked = packet[2] & ALL_FRAGMENTS;
+    if (acked == ALL_FRAGMENTS) {
+      state = OTAR_DONE;
+      clean(message, sizeof(message));
+      authenticator.clear();
+    }
+    return true;
+  }
+
+  bool sending() const {
+    return state == OTAR_SENDING;
+  }
+
+  bool finished() const {
+    return state == OTAR_DONE;
+  }
+
+  bool failed() const {
+    return state == OTAR_FAILED;
+  }
+
+  void cancel() {
+    clean(message, sizeof(message));
+    authenticator.clear();
+    state = OTAR_IDLE;
+  }
+
+  const OtarStats &statistics() const {
+    return stats;
+  }
+
+  void resetStats() {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+private:
+  enum State {
+    OTAR_IDLE,
+    OTAR_SENDING,
+    OTAR_DONE,
+    OTAR_FAILED
+  };
+
+  static const uint8_t ALL_FRAGMENTS = (1 << OTAR_FRAGMENTS) - 1;
+
+  static uint8_t popcount(uint8_t bits) {
+    uint8_t count = 0;
+    for (; bits; bits &= bits - 1) {
+      count++;
+    }
+    return count;
+  }
+
+  uint8_t message[OTAR_MESSAGE_LENGTH];
+  PacketAuthenticator authenticator;
+  State state;
+  uint8_t rekeyId;
+  uint8_t acked;
+  uint8_t sentThisRound;
+  uint8_t rounds;
+  bool waiting;
+  uint32_t waitingSince;
+  OtarStats stats;
+};
+
+class OtarReceiver {
+public:
+  OtarReceiver() : held(0), haveId(false), ready(false) {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+  // Pass every received packet that may be an OTAR fragment here with the
+  // current epoch's KEY_PURPOSE_KEY_WRAP and KEY_PURPOSE_OTAR_AUTH subkeys.
+  // Writes an ack to send back (low priority, like the fragments) and
+  // returns its length, or 0 if the packet was not an authentic OTAR
+  // fragment (and belongs to the data path).
+  size_t handlePacket(const uint8_t *packet, size_t length, const uint8_t *kek,
+                      const uint8_t *authKey, uint8_t *ack) {
+    if (length <= OTAR_FRAGMENT_HEADER + OTAR_TAG_SIZE || packet[0] != OTAR_PACKET_FRAGMENT ||
+        packet[3] != OTAR_FRAGMENTS || packet[2] >= OTAR_FRAGMENTS) {
+      return 0;
+    }
+    uint8_t id = packet[1];
+    uint8_t index = packet[2];
+    size_t offset = index * OTAR_FRAGMENT_DATA;
+    size_t expected = OTAR_MESSAGE_LENGTH - offset;
+    if (expected > OTAR_FRAGMENT_DATA) {
+      expected = OTAR_FRAGMENT_DATA;
+    }
+    if (length != OTAR_FRAGMENT_HEADER + expected + OTAR_TAG_SIZE) {
+      return 0;
+    }
+    authenticator.begin(authKey, SUBKEY_LENGTH, OTAR_TAG_SIZE);
+    if (authenticator.open(packet, length) < 0) {
+      stats.forged++;
+      return 0;
+    }
+
+    // A new rekey replaces one that never completed
+    if (!haveId || id != rekeyId) {
+      clean(message, sizeof(message));
+      rekeyId = id;
+      haveId = true;
+      held = 0;
+    }
+    // Fragments of a completed rekey are only acked again. held only
+    // reaches ALL_FRAGMENTS when the message unwraps, so the ack never
+    // reports a message the receiver could not use.
+    if (held != ALL_FRAGMENTS) {
+      memcpy(message + offset, packet + OTAR_FRAGMENT_HEADER, expected);
+      held |= 1 << index;
+      if (held == ALL_FRAGMENTS && !unwrapMessage(kek)) {
+        held = 0;
+      }
+    }
+
+    ack[0] = OTAR_PACKET_ACK;
+    ack[1] = rekeyId;
+    ack[2] = held;
+    authenticator.seal(ack, OTAR_ACK_SIZE - OTAR_TAG_SIZE);
+    authenticator.clear();
+    stats.acksSent++;
+    stats.bytesSent += OTAR_ACK_SIZE;
+    return OTAR_ACK_SIZE;
+  }
+
+  // True once a complete message has passed the key wrap check
+  bool keyReady() const {
+    return ready;
+  }
+
+  // Hand over the received key; it is wiped here afterwards
+  bool takeKey(uint8_t *key, uint64_t *epoch, uint64_t *activationHop) {
+    if (!ready) {
+      return false;
+    }
+    memcpy(key, plain, OTAR_KEY_LENGTH);
+    *activationHop = 0;
+    *epoch = 0;
+    for (int i = 0; i < 8; i++) {
+      *activationHop = (*activationHop << 8) | plain[OTAR_KEY_LENGTH + i];
+      *epoch = (*epoch << 8) | plain[OTAR_KEY_LENGTH + 8 + i];
+    }
+    clean(plain, sizeof(plain));
+    ready = false;
+    return true;
+  }
+
+  const OtarStats &statistics() const {
+    return stats;
+  }
+
+  void resetStats() {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+private:
+  static const uint8_t ALL_FRAGMENTS = (1 << OTAR_FRAGMENTS) - 1;
+
+  bool unwrapMessage(const uint8_t *kek) {
+    KeyWrap keyWrap;
+    keyWrap.setKek(kek, SUBKEY_LENGTH);
+    ready = keyWrap.unwrap(message, OTAR_MESSAGE_LENGTH, plain);
+    keyWrap.clear();
+    clean(message, sizeof(message));
+    if (!ready) {
+      stats.rejected++;
+    }
+    return ready;
+  }
+
+  uint8_t message[OTAR_MESSAGE_LENGTH];
+  uint8_t plain[OTAR_PLAIN_LENGTH];
+  PacketAuthenticator authenticator;
+  uint8_t rekeyId;
+  uint8_t held;
+  bool haveId;
+  bool ready;
+  OtarStats stats;
+};
+
+#endif // OTAR_H
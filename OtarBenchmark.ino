@@ -0,0 +1,159 @@
+#include "Otar.h"
+#include "TransecKeyRing.h"
+
+// Two simulated nodes rekeying over a lossy loopback link. Each slot
+// carries one packet each way; data traffic takes a slot first and OTAR
+// only gets the slots it leaves free. Time is counted in slots so runs are
+// repeatable and do not depend on the board.
+
+#define NUMBER_OF_CHANNELS 100
+#define SLOT_MS 10             // one packet each way per slot
+#define SLOTS_PER_HOP 50       // 500 ms dwell
+#define DATA_LOAD_PERCENT 70   // share of slots taken by data traffic
+#define ACTIVATION_LEAD_HOPS 20
+#define MAX_SLOTS (ACTIVATION_LEAD_HOPS * SLOTS_PER_HOP)
+#define CHECK_HOPS 10          // hops compared either side of the switchover
+
+const int LOSS_PERCENTS[] = {0, 10, 30, 50};
+
+// Fixed example keys so runs are comparable between boards
+const uint8_t CURRENT_KEY[MASTER_KEY_LENGTH] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+const uint8_t NEXT_KEY[MASTER_KEY_LENGTH] = {
+  0xF0, 0xE1, 0xD2, 0xC3, 0xB4, 0xA5, 0x96, 0x87, 0x78, 0x69, 0x5A, 0x4B, 0x3C, 0x2D, 0x1E, 0x0F,
+  0x0F, 0x1E, 0x2D, 0x3C, 0x4B, 0x5A, 0x69, 0x78, 0x87, 0x96, 0xA5, 0xB4, 0xC3, 0xD2, 0xE1, 0xF0
+};
+
+TransecKeyRing senderRing(NUMBER_OF_CHANNELS, true);
+TransecKeyRing receiverRing(NUMBER_OF_CHANNELS, true);
+uint32_t lossState;
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  Serial.println("OTAR loopback benchmark");
+  Serial.println("  " + String(OTAR_MESSAGE_LENGTH) + " byte message in " + String(OTAR_FRAGMENTS) +
+                 " fragments, " + String(DATA_LOAD_PERCENT) + "% data load");
+  for (unsigned int i = 0; i < sizeof(LOSS_PERCENTS) / sizeof(LOSS_PERCENTS[0]); i++) {
+    runRekey(LOSS_PERCENTS[i]);
+  }
+}
+
+void loop() {
+}
+
+// xorshift32: repeatable packet loss and data load
+uint32_t nextRandom() {
+  lossState ^= lossState << 13;
+  lossState ^= lossState >> 17;
+  lossState ^= lossState << 5;
+  return lossState;
+}
+
+bool chance(int percent) {
+  return nextRandom() % 100 < (uint32_t)percent;
+}
+
+void runRekey(int lossPercent) {
+  lossState = 0x9E3779B9;
+  senderRing.begin(CURRENT_KEY, 0);
+  receiverRing.begin(CURRENT_KEY, 0);
+  OtarSender sender;
+  OtarReceiver receiver;
+
+  // The sender schedules the key for itself and sends it to the receiver
+  uint64_t activationHop = ACTIVATION_LEAD_HOPS;
+  senderRing.scheduleNext(NEXT_KEY, 1, activationHop);
+  sender.begin(senderRing.subkey(0, KEY_PURPOSE_KEY_WRAP),
+               senderRing.subkey(0, KEY_PURPOSE_OTAR_AUTH), NEXT_KEY, 1, activationHop);
+
+  // Someone without the key claims every fragment arrived, and sends a
+  // fragment of their own: neither may be taken
+  uint8_t forged[OTAR_PACKET_SIZE];
+  memset(forged, 0, sizeof(forged));
+  forged[0] = OTAR_PACKET_ACK;
+  forged[1] = 1;
+  forged[2] = (1 << OTAR_FRAGMENTS) - 1;
+  bool forgeryRefused = !sender.handlePacket(forged, OTAR_ACK_SIZE) && sender.sending();
+  forged[0] = OTAR_PACKET_FRAGMENT;
+  forged[2] = 0;
+  forged[3] = OTAR_FRAGMENTS;
+  size_t forgedLength = OTAR_FRAGMENT_HEADER + OTAR_FRAGMENT_DATA + OTAR_TAG_SIZE;
+  forgeryRefused &= receiver.handlePacket(forged, forgedLength,
+                                          receiverRing.subkey(0, KEY_PURPOSE_KEY_WRAP),
+                                          receiverRing.subkey(0, KEY_PURPOSE_OTAR_AUTH), forged) == 0;
+
+  uint8_t forward[OTAR_PACKET_SIZE], reverse[OTAR_PACKET_SIZE];
+  size_t reverseLength = 0;
+  uint32_t slot = 0, otarSlots = 0, dataSlots = 0;
+  bool scheduled = false;
+  for (; slot < MAX_SLOTS && !(sender.finished() && scheduled); slot++) {
+    uint64_t hop = slot / SLOTS_PER_HOP;
+    const uint8_t *receiverKek = receiverRing.subkey(hop, KEY_PURPOSE_KEY_WRAP);
+    const uint8_t *receiverAuthKey = receiverRing.subkey(hop, KEY_PURPOSE_OTAR_AUTH);
+
+    // Sender to receiver
+    size_t forwardLength = 0;
+    if (chance(DATA_LOAD_PERCENT)) {
+      dataSlots++;
+    } else {
+      forwardLength = sender.nextPacket(forward, slot * SLOT_MS);
+      otarSlots += forwardLength > 0;
+    }
+    if (forwardLength > 0 && !chance(lossPercent)) {
+      size_t ackLength = receiver.handlePacket(forward, forwardLength, receiverKek, receiverAuthKey,
+                                               reverse);
+      reverseLength = ackLength > 0 ? ackLength : reverseLength;
+    }
+    if (receiver.keyReady()) {
+      uint8_t key[MASTER_KEY_LENGTH];
+      uint64_t epoch, keyHop;
+      receiver.takeKey(key, &epoch, &keyHop);
+      scheduled = epoch == 1 && keyHop > hop + 1 && receiverRing.scheduleNext(key, epoch, keyHop);
+      clean(key, sizeof(key));
+    }
+
+    // Receiver to sender: the latest ack goes out in the next free slot
+    if (chance(DATA_LOAD_PERCENT)) {
+      dataSlots++;
+    } else if (reverseLength > 0) {
+      otarSlots++;
+      if (!chance(lossPercent)) {
+        sender.handlePacket(reverse, reverseLength);
+      }
+      reverseLength = 0;
+    }
+    senderRing.prepare();
+    receiverRing.prepare();
+  }
+
+  // Both nodes must switch at the agreed hop and then hop identically
+  bool match = scheduled && forgeryRefused;
+  for (uint64_t hop = activationHop - CHECK_HOPS; hop < activationHop + CHECK_HOPS; hop++) {
+    senderRing.advance(hop);
+    receiverRing.advance(hop);
+    match &= senderRing.channel(hop) == receiverRing.channel(hop);
+    match &= senderRing.activeEpoch() == (hop < activationHop ? 0 : 1);
+    match &= receiverRing.activeEpoch() == senderRing.activeEpoch();
+  }
+
+  const OtarStats &sent = sender.statistics();
+  const OtarStats &acked = receiver.statistics();
+  uint32_t otarBytes = sent.bytesSent + acked.bytesSent;
+  uint32_t capacityBytes = 2 * slot * OTAR_PACKET_SIZE;
+  uint32_t leadCapacityBytes = 2 * MAX_SLOTS * OTAR_PACKET_SIZE;
+  Serial.println("  " + String(lossPercent) + "% loss: " + (match ? "switched at hop " +
+                 String((unsigned long)activationHop) : String("FAILED")));
+  Serial.println("    " + String(slot * SLOT_MS) + " ms, " + String(sent.fragmentsSent) +
+                 " fragments (" + String(sent.retransmissions) + " resent), " +
+                 String(acked.acksSent) + " acks, " + String(otarBytes) + " bytes in " +
+                 String(otarSlots) + " slots");
+  Serial.print("    link capacity used: ");
+  Serial.print(100.0f * otarBytes / capacityBytes, 2);
+  Serial.print("% while rekeying, ");
+  Serial.print(100.0f * otarBytes / leadCapacityBytes, 2);
+  Serial.println("% of the activation lead time");
+}
@@ -0,0 +1,72 @@
+#ifndef PACKET_AUTHENTICATOR_H
+#define PACKET_AUTHENTICATOR_H
+
+#include "HmacContext.h"
+
+// Per-link packet authentication with truncated HMAC-SHA256 tags.
+//
+//   [message] [tag (tagLength)]
+//
+// The tag is the first tagLength bytes of HMAC-SHA256 over the message
+// (RFC 2104 section 5) and is sent inline after it. A full 32-byte tag
+// doubles the size of a 32-byte RF chunk, so each link picks 4, 8, 12 or
+// 16 bytes: a forgery attempt succeeds with probability 2^-(8 * tagLength),
+// and every attempt costs the attacker one packet on the air under a key
+// that changes each epoch. Tags are checked in constant time.
+
+#define PACKET_AUTH_MAX_TAG 16
+
+class PacketAuthenticator {
+public:
+  PacketAuthenticator() : tagLength(PACKET_AUTH_MAX_TAG) {}
+
+  // Only 4, 8, 12 and 16 byte tags are allowed
+  static bool validTagLength(size_t length) {
+    return length == 4 || length == 8 || length == 12 || length == 16;
+  }
+
+  // Returns false, leaving the link unkeyed, for any other tag length
+  bool begin(const uint8_t *key, size_t keyLength, size_t linkTagLength) {
+    if (!validTagLength(linkTagLength)) {
+      hmac.clear();
+      return false;
+    }
+    tagLength = linkTagLength;
+    hmac.setKey(key, keyLength);
+    return true;
+  }
+
+  size_t tagSize() const {
+    return tagLength;
+  }
+
+  // Appends the tag after messageLength bytes of packet; returns the packet
+  // length. The buffer needs tagSize() bytes of room after the message.
+  size_t seal(uint8_t *packet, size_t messageLength) {
+    hmac.compute(packet, messageLength, packet + messageLength, tagLength);
+    return messageLength + tagLength;
+  }
+
+  // Checks the tag at the end of a received packet and returns the message
+  // length, or -1 if the packet is too short or not authentic
+  int open(const uint8_t *packet, size_t packetLength) {
+    if (packetLength < tagLength) {
+      return -1;
+    }
+    size_t messageLength = packetLength - tagLength;
+    if (!hmac.verify(packet, messageLength, packet + messageLength, tagLength)) {
+      return -1;
+    }
+    return (int)messageLength;
+  }
+
+  void clear() {
+    hmac.clear();
+  }
+
+private:
+  HmacContext hmac;
+  size_t tagLength;
+};
+
+#endif // PACKET_AUTHENTICATOR_H
@@ -0,0 +1,243 @@
+#ifndef PACKET_PROTECTOR_H
+#define PACKET_PROTECTOR_H
+
+#include <GHASH.h>
+#include <Crypto.h>
+#include "AesCtr.h"
+
+// AES-GCM (NIST SP 800-38D) packet protection in one pass, in place.
+//
+// A packet buffer holds
+//
+//   [header (authenticated)] [payload (encrypted)] [tag (16)]
+//
+// protect() encrypts the payload and appends the tag; unprotect() checks
+// the tag in constant time and decrypts. Both walk the payload once in
+// PACKET_PROTECTOR_CHUNK pieces, running CTR and GHASH over each piece
+// while it is hot, instead of an encryption pass and a separate MAC pass
+// with another key and library. The CTR side is any AesCtrCipher, so the
+// SAMD51 AES peripheral does the block encryption when it is there; the
+// hash key H and the tag mask E(K, J0) come out of the same cipher as CTR
+// output over zero blocks.
+//
+// Nonces are 12 bytes and must never repeat under one key. The
+// *WithKeystream() variants take E(K, J0), E(K, J0 + 1), ... generated
+// ahead of time (KeystreamPrefetcher.h) and do no block encryption at all.
+//
+// For messages that are produced or sent in pieces, beginStream(), then
+// encryptStream() or decryptStream() over the payload in pieces of any
+// length, then finishStream() or verifyStream() give the same result
+// without the whole message ever being in one buffer. A receiver must not
+// act on streamed plaintext until verifyStream() has returned true.
+
+#define PACKET_NONCE_SIZE 12
+#define PACKET_TAG_SIZE 16
+#define PACKET_PROTECTOR_CHUNK 64 // multiple of AES_BLOCK_SIZE
+
+class PacketProtector {
+public:
+  PacketProtector(AesCtrCipher &ctrCipher)
+    : cipher(ctrCipher), streamUsed(AES_BLOCK_SIZE), streamHeaderLength(0), streamLength(0) {}
+
+  bool setKey(const uint8_t *key, size_t length) {
+    if (!cipher.setKey(key, length)) {
+      return false;
+    }
+    static const uint8_t zero[AES_BLOCK_SIZE] = {0};
+    cipher.crypt(zero, zero, hashKey, AES_BLOCK_SIZE); // H = E(K, 0^128)
+    return true;
+  }
+
+  // Encrypt payloadLength bytes after the header in place and write the tag
+  // after them
+  void protect(const uint8_t *nonce, uint8_t *packet, size_t headerLength, size_t payloadLength) {
+    uint8_t counter[AES_BLOCK_SIZE];
+    start(nonce, packet, headerLength, counter);
+    uint8_t *payload = packet + headerLength;
+    for (size_t offset = 0; offset < payloadLength; offset += PACKET_PROTECTOR_CHUNK) {
+      size_t n = chunkLength(offset, payloadLength);
+      cipher.crypt(counter, payload + offset, payload + offset, n);
+      ghash.update(payload + offset, n);
+      aesCtrAdd(counter, PACKET_PROTECTOR_CHUNK / AES_BLOCK_SIZE);
+    }
+    finish(headerLength, payloadLength, payload + payloadLength);
+  }
+
+  // Check the tag after the payload and decrypt in place. On failure the
+  // payload is wiped and false is returned.
+  bool unprotect(const uint8_t *nonce, uint8_t *packet, size_t headerLength, size_t payloadLength) {
+    uint8_t counter[AES_BLOCK_SIZE];
+    start(nonce, packet, headerLength, counter);
+    uint8_t *payload = packet + headerLength;
+    for (size_t offset = 0; offset < payloadLength; offset += PACKET_PROTECTOR_CHUNK) {
+      size_t n = chunkLength(offset, payloadLength);
+      ghash.update(payload + offset, n);
+      cipher.crypt(counter, payload + offset, payload + offset, n);
+      aesCtrAdd(counter, PACKET_PROTECTOR_CHUNK / AES_BLOCK_SIZE);
+    }
+    return checkTag(headerLength, payload, payloadLength);
+  }
+
+  // As protect(), with keystream holding the tag mask block followed by at
+  // least payloadLength bytes of payload keystream
+  void protectWithKeystream(const uint8_t *keystream, uint8_t *packet, size_t headerLength,
+                            size_t payloadLength) {
+    startHash(packet, headerLength);
+    memcpy(tagMask, keystream, AES_BLOCK_SIZE);
+    uint8_t *payload = packet + headerLength;
+    const uint8_t *stream = keystream + AES_BLOCK_SIZE;
+    for (size_t offset = 0; offset < payloadLength; offset += PACKET_PROTECTOR_CHUNK) {
+      size_t n = chunkLength(offset, payloadLength);
+      for (size_t i = offset; i < offset + n; i++) {
+        payload[i] ^= stream[i];
+      }
+      ghash.update(payload + offset, n);
+    }
+    finish(headerLength, payloadLength, payload + payloadLength);
+  }
+
+  bool unprotectWithKeystream(const uint8_t *keystream, uint8_t *packet, size_t headerLength,
+                              size_t payloadLength) {
+    startHash(packet, headerLength);
+    memcpy(tagMask, keystream, AES_BLOCK_SIZE);
+    uint8_t *payload = packet + headerLength;
+    const uint8_t *stream = keystream + AES_BLOCK_SIZE;
+    for (size_t offset = 0; offset < payloadLength; offset += PACKET_PROTECTOR_CHUNK) {
+      size_t n = chunkLength(offset, payloadLength);
+      ghash.update(payload + offset, n);
+      for (size_t i = offset; i < offset + n; i++) {
+        payload[i] ^= stream[i];
+      }
+    }
+    return checkTag(headerLength, payload, payloadLength);
+  }
+
+  void beginStream(const uint8_t *nonce, const uint8_t *header, size_t headerLength) {
+    start(nonce, header, headerLength, streamCounter);
+    streamHeaderLength = headerLength;
+    streamLength = 0;
+    streamUsed = AES_BLOCK_SIZE;
+  }
+
+  void encryptStream(const uint8_t *in, uint8_t *out, size_t length) {
+    streamCrypt(in, out, length);
+    ghash.update(out, length);
+  }
+
+  void decryptStream(const uint8_t *in, uint8_t *out, size_t length) {
+    ghash.update(in, length);
+    streamCrypt(in, out, length);
+  }
+
+  void finishStream(uint8_t *tag) {
+    finish(streamHeaderLength, streamLength, tag);
+    clean(streamBlock, sizeof(streamBlock));
+  }
+
+  bool verifyStream(const uint8_t *tag) {
+    uint8_t expected[PACKET_TAG_SIZE];
+    finishStream(expected);
+    bool authentic = secure_compare(expected, tag, PACKET_TAG_SIZE);
+    clean(expected, sizeof(expected));
+    return authentic;
+  }
+
+  void clear() {
+    cipher.clear();
+    ghash.clear();
+    clean(hashKey, sizeof(hashKey));
+    clean(tagMask, sizeof(tagMask));
+    clean(streamBlock, sizeof(streamBlock));
+  }
+
+private:
+  static size_t chunkLength(size_t offset, size_t length) {
+    return length - offset < PACKET_PROTECTOR_CHUNK ? length - offset : PACKET_PROTECTOR_CHUNK;
+  }
+
+  // J0 = nonce || 1; the tag mask is E(K, J0) and the payload starts at J0 + 1
+  void start(const uint8_t *nonce, const uint8_t *header, size_t headerLength, uint8_t *counter) {
+    static const uint8_t zero[AES_BLOCK_SIZE] = {0};
+    memcpy(counter, nonce, PACKET_NONCE_SIZE);
+    counter[12] = 0;
+    counter[13] = 0;
+    counter[14] = 0;
+    counter[15] = 1;
+    cipher.crypt(counter, zero, tagMask, AES_BLOCK_SIZE);
+    aesCtrIncrement(counter);
+    startHash(header, headerLength);
+  }
+
+  void startHash(const uint8_t *header, size_t headerLength) {
+    ghash.reset(hashKey);
+    ghash.update(header, headerLength);
+    ghash.pad();
+  }
+
+  // GHASH the bit lengths and mask the result into the tag
+  void finish(size_t headerLength, size_t payloadLength, uint8_t *tag) {
+    uint8_t lengths[AES_BLOCK_SIZE];
+    uint64_t headerBits = (uint64_t)headerLength * 8;
+    uint64_t payloadBits = (uint64_t)payloadLength * 8;
+    for (int i = 0; i < 8; i++) {
+      lengths[i] = (uint8_t)(headerBits >> (56 - 8 * i));
+      lengths[8 + i] = (uint8_t)(payloadBits >> (56 - 8 * i));
+    }
+    ghash.pad();
+    ghash.update(lengths, sizeof(lengths));
+    ghash.finalize(tag, PACKET_TAG_SIZE);
+    for (int i = 0; i < PACKET_TAG_SIZE; i++) {
+      tag[i] ^= tagMask[i];
+    }
+  }
+
+  // CTR across calls: leftover keystream first, then whole blocks straight
+  // through the cipher, then one more block for a partial tail
+  void streamCrypt(const uint8_t *in, uint8_t *out, size_t length) {
+    streamLength += length;
+    while (length > 0 && streamUsed < AES_BLOCK_SIZE) {
+      *out++ = *in++ ^ streamBlock[streamUsed++];
+      length--;
+    }
+    size_t whole = length & ~(size_t)(AES_BLOCK_SIZE - 1);
+    if (whole > 0) {
+      cipher.crypt(streamCounter, in, out, whole);
+      aesCtrAdd(streamCounter, whole / AES_BLOCK_SIZE);
+      in += whole;
+      out += whole;
+      length -= whole;
+    }
+    if (length > 0) {
+      static const uint8_t zero[AES_BLOCK_SIZE] = {0};
+      cipher.crypt(streamCounter, zero, streamBlock, AES_BLOCK_SIZE);
+      aesCtrIncrement(streamCounter);
+      for (streamUsed = 0; streamUsed < length; streamUsed++) {
+        out[streamUsed] = in[streamUsed] ^ streamBlock[streamUsed];
+      }
+    }
+  }
+
+  // Compare with the tag after the payload; wipe the payload if it differs
+  bool checkTag(size_t headerLength, uint8_t *payload, size_t payloadLength) {
+    uint8_t expected[PACKET_TAG_SIZE];
+    finish(headerLength, payloadLength, expected);
+    bool authentic = secure_compare(expected, payload + payloadLength, PACKET_TAG_SIZE);
+    clean(expected, sizeof(expected));
+    if (!authentic) {
+      clean(payload, payloadLength);
+    }
+    return authentic;
+  }
+
+  AesCtrCipher &cipher;
+  GHASH ghash;
+  uint8_t hashKey[AES_BLOCK_SIZE];
+  uint8_t tagMask[AES_BLOCK_SIZE];
+  uint8_t streamCounter[AES_BLOCK_SIZE];
+  uint8_t streamBlock[AES_BLOCK_SIZE];
+  size_t streamUsed;
+  size_t streamHeaderLength;
+  size_t streamLength;
+};
+
+#endif // PACKET_PROTECTOR_H
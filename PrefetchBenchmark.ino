@@ -0,0 +1,130 @@
+#include "CycleCounter.h"
+#include "AesCtr.h"
+#include "PacketProtector.h"
+#include "KeystreamPrefetcher.h"
+
+// Packet protection latency with the keystream generated on demand against
+// prefetched keystream, and the hit rate for different amounts of idle
+// time between packets.
+
+#define HEADER_SIZE 8
+#define PACKETS 1000
+
+const size_t PAYLOAD_SIZES[] = {32, 64, 128};
+const int IDLE_SERVICE_CALLS[] = {0, 1, 2, 4}; // service() calls between packets
+
+const uint8_t TRAFFIC_KEY[16] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F
+};
+
+PlatformAesCtr aes;
+PacketProtector protector(aes);
+KeystreamPrefetcher prefetcher(aes);
+uint8_t packet[HEADER_SIZE + KEYSTREAM_MAX_PAYLOAD + PACKET_TAG_SIZE];
+uint8_t reference[HEADER_SIZE + KEYSTREAM_MAX_PAYLOAD + PACKET_TAG_SIZE];
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  aes.begin();
+  protector.setKey(TRAFFIC_KEY, sizeof(TRAFFIC_KEY));
+  Serial.println("Keystream prefetch benchmark (" + String(aes.name()) + ")");
+
+  Serial.println("  cycles per protect: inline, prefetched (hit), miss");
+  for (unsigned int s = 0; s < sizeof(PAYLOAD_SIZES) / sizeof(PAYLOAD_SIZES[0]); s++) {
+    benchmarkLatency(PAYLOAD_SIZES[s]);
+  }
+
+  Serial.println("  hit rate by idle service() calls between packets:");
+  for (unsigned int i = 0; i < sizeof(IDLE_SERVICE_CALLS) / sizeof(IDLE_SERVICE_CALLS[0]); i++) {
+    benchmarkHitRate(IDLE_SERVICE_CALLS[i]);
+  }
+}
+
+void loop() {
+}
+
+// Example nonce: a fixed 8-byte link prefix and the sequence number
+void sequenceNonce(uint32_t sequence, uint8_t *nonce) {
+  static const uint8_t prefix[8] = {0x4C, 0x49, 0x4E, 0x4B, 0x00, 0x00, 0x00, 0x01};
+  memcpy(nonce, prefix, sizeof(prefix));
+  nonce[8] = (uint8_t)(sequence >> 24);
+  nonce[9] = (uint8_t)(sequence >> 16);
+  nonce[10] = (uint8_t)(sequence >> 8);
+  nonce[11] = (uint8_t)sequence;
+}
+
+void fillPacket(uint8_t *buffer, size_t payloadSize) {
+  for (size_t i = 0; i < HEADER_SIZE + payloadSize; i++) {
+    buffer[i] = (uint8_t)i;
+  }
+}
+
+void benchmarkLatency(size_t payloadSize) {
+  uint8_t nonce[PACKET_NONCE_SIZE];
+  uint32_t inlineCycles = 0, hitCycles = 0, missCycles = 0;
+  bool match = true;
+  prefetcher.begin(sequenceNonce, 0);
+
+  for (uint32_t sequence = 0; sequence < PACKETS; sequence++) {
+    // Inline: nonce, block encryption and GHASH when the packet is sent
+    fillPacket(reference, payloadSize);
+    uint32_t startCycles = cycleCount();
+    sequenceNonce(sequence, nonce);
+    protector.protect(nonce, reference, HEADER_SIZE, payloadSize);
+    inlineCycles += cycleCount() - startCycles;
+
+    // Prefetched while idle, then XOR and GHASH when the packet is sent
+    while (prefetcher.service());
+    fillPacket(packet, payloadSize);
+    startCycles = cycleCount();
+    protector.protectWithKeystream(prefetcher.keystream(sequence, payloadSize), packet,
+                                   HEADER_SIZE, payloadSize);
+    hitCycles += cycleCount() - startCycles;
+    match &= memcmp(packet, reference, HEADER_SIZE + payloadSize + PACKET_TAG_SIZE) == 0;
+  }
+
+  // Miss: every sequence number jumps past the prefetched window
+  prefetcher.begin(sequenceNonce, 0);
+  for (uint32_t p = 0; p < PACKETS; p++) {
+    uint32_t sequence = p * 2 * KEYSTREAM_PREFETCH_PACKETS + KEYSTREAM_PREFETCH_PACKETS;
+    fillPacket(packet, payloadSize);
+    uint32_t startCycles = cycleCount();
+    protector.protectWithKeystream(prefetcher.keystream(sequence, payloadSize), packet,
+                                   HEADER_SIZE, payloadSize);
+    missCycles += cycleCount() - startCycles;
+  }
+
+  Serial.print("    ");
+  Serial.print(payloadSize);
+  Serial.print(" bytes: ");
+  Serial.print(inlineCycles / PACKETS);
+  Serial.print(", ");
+  Serial.print(hitCycles / PACKETS);
+  Serial.print(", ");
+  Serial.print(missCycles / PACKETS);
+  Serial.println(match ? "" : "  MISMATCH");
+}
+
+void benchmarkHitRate(int serviceCalls) {
+  // Start cold, then packets arrive with this much idle time between them
+  prefetcher.begin(sequenceNonce, 0);
+  prefetcher.resetStats();
+  for (uint32_t sequence = 0; sequence < PACKETS; sequence++) {
+    for (int i = 0; i < serviceCalls; i++) {
+      prefetcher.service();
+    }
+    fillPacket(packet, KEYSTREAM_MAX_PAYLOAD);
+    protector.protectWithKeystream(prefetcher.keystream(sequence, KEYSTREAM_MAX_PAYLOAD), packet,
+                                   HEADER_SIZE, KEYSTREAM_MAX_PAYLOAD);
+  }
+  Serial.print("    ");
+  Serial.print(serviceCalls);
+  Serial.print(": ");
+  Serial.print(prefetcher.hitCount());
+  Serial.print(" hits, ");
+  Serial.print(prefetcher.missCount());
+  Serial.println(" misses");
+}
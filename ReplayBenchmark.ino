@@ -0,0 +1,174 @@
+#include "CycleCounter.h"
+#include "ImplicitNonce.h"
+#include "PacketAuthenticator.h"
+#include "PacketProtector.h"
+#include "ReplayWindow.h"
+
+// Cost of dropping a replayed packet with the window check against
+// authenticating it, the window's counters for a stream with reordering,
+// duplicates and a replay flood, and replays of per-hop sequence numbers
+// within a hop and into later hops.
+
+#define LINK_HEADER_SIZE 5 // link id, sequence number
+#define MESSAGE_SIZE 23
+#define TAG_LENGTH 4
+#define PACKETS 10000
+#define REORDER_SPAN 200 // how far behind the sender a packet can arrive
+#define HOPS 100
+#define PACKETS_PER_HOP 16
+
+const uint8_t MAC_KEY[32] = {
+  0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07, 0x08, 0x09, 0x0A, 0x0B, 0x0C, 0x0D, 0x0E, 0x0F,
+  0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17, 0x18, 0x19, 0x1A, 0x1B, 0x1C, 0x1D, 0x1E, 0x1F
+};
+
+PacketAuthenticator authenticator;
+ReplayWindow<64> window64;
+ReplayWindow<256> window256;
+ReplayWindow<1024> window1024;
+HopReplayWindow<128> hopWindow;
+ImplicitNonce senderNonces(1, PACKET_DIRECTION_OUT);
+ImplicitNonce receiverNonces(1, PACKET_DIRECTION_OUT);
+uint8_t packet[LINK_HEADER_SIZE + MESSAGE_SIZE + TAG_LENGTH];
+volatile uint8_t sink; // keeps the compiler from discarding results
+
+void setup() {
+  Serial.begin(115200);
+  while (!Serial); // Wait for Serial Monitor to open
+
+  cycleCounterBegin();
+  authenticator.begin(MAC_KEY, sizeof(MAC_KEY), TAG_LENGTH);
+  memset(packet, 0x5A, sizeof(packet));
+  authenticator.seal(packet, LINK_HEADER_SIZE + MESSAGE_SIZE);
+
+  Serial.println("Anti-replay window benchmark");
+  benchmarkDropCost();
+  Serial.println("  reordered stream with every 4th packet replayed: accepted, duplicate, too old");
+  benchmarkStream();
+  Serial.println("  per-hop sequence numbers, every packet replayed in its hop and the next:");
+  benchmarkHopReplays();
+}
+
+void loop() {
+}
+
+// A flood of copies of one accepted packet: window check against the MAC
+// work the receiver would otherwise do for each
+void benchmarkDropCost() {
+  window256.reset();
+  window256.accept(1000);
+  bool dropped = true;
+  uint32_t startCycles = cycleCount();
+  for (int i = 0; i < PACKETS; i++) {
+    dropped &= !window256.check(1000);
+  }
+  uint32_t checkCycles = cycleCount() - startCycles;
+
+  int result = 0;
+  startCycles = cycleCount();
+  for (int i = 0; i < PACKETS / 10; i++) {
+    result += authenticator.open(packet, sizeof(packet));
+  }
+  uint32_t openCycles = cycleCount() - startCycles;
+  sink = (uint8_t)result;
+
+  Serial.print("  per replayed packet: window check ");
+  Serial.print((float)checkCycles / PACKETS, 1);
+  Serial.print(" cycles, MAC check ");
+  Serial.print(openCycles / (PACKETS / 10));
+  Serial.println(dropped ? " cycles" : " cycles  NOT DROPPED");
+}
+
+// Packets arrive up to REORDER_SPAN behind the sender, so some come late
+// or more than once, and every 4th one is replayed;
+// the same stream goes to each window size
+void benchmarkStream() {
+  window64.reset();
+  window256.reset();
+  window1024.reset();
+  window64.resetStats();
+  window256.resetStats();
+  window1024.resetStats();
+  uint32_t state = 1;
+  for (uint32_t sequence = 0; sequence < PACKETS; sequence++) {
+    state = state * 1103515245 + 12345;
+    uint32_t late = (state >> 16) % REORDER_SPAN;
+    uint32_t received = sequence > late ? sequence - late : sequence;
+    int copies = sequence % 4 == 0 ? 2 : 1;
+    for (int copy = 0; copy < copies; copy++) {
+      if (window64.check(received)) {
+        window64.accept(received);
+      }
+      if (window256.check(received)) {
+        window256.accept(received);
+      }
+      if (window1024.check(received)) {
+        window1024.accept(received);
+      }
+    }
+  }
+  printStats("64", window64.statistics());
+  printStats("256", window256.statistics());
+  printStats("1024", window1024.statistics());
+}
+
+void printStats(const char *name, const ReplayStats &stats) {
+  Serial.print("    ");
+  Serial.print(name);
+  Serial.print(" bits: ");
+  Serial.print(stats.accepted);
+  Serial.print(", ");
+  Serial.print(stats.duplicates);
+  Serial.print(", ");
+  Serial.println(stats.tooOld);
+}
+
+// Each packet is received in its hop, then an attacker sends it again in
+// the same hop and in the next one. Every copy must be dropped before the
+// tag check: by the window within the hop, by the hop check byte after it.
+void benchmarkHopReplays() {
+  uint8_t nonce[PACKET_NONCE_SIZE];
+  uint8_t headers[PACKETS_PER_HOP][PACKET_NONCE_HEADER_BYTES];
+  uint32_t sequence, replays = 0, dropped = 0, accepted = 0, dropCycles = 0;
+  memset(headers, 0, sizeof(headers)); // nothing sent before hop 1
+  hopWindow.reset();
+  hopWindow.resetStats();
+  for (uint64_t hop = 1; hop <= HOPS; hop++) {
+    // Last hop's packets replayed in this one
+    for (int i = 0; i < PACKETS_PER_HOP; i++) {
+      replays++;
+      uint32_t startCycles = cycleCount();
+      bool drop = !receiverNonces.expand(hop, headers[i], nonce, &sequence) ||
+                  !hopWindow.check(hop, sequence);
+      dropCycles += cycleCount() - startCycles;
+      dropped += drop;
+    }
+    for (int i = 0; i < PACKETS_PER_HOP; i++) {
+      senderNonces.next(hop, nonce, headers[i]);
+      if (receiverNonces.expand(hop, headers[i], nonce, &sequence) &&
+          hopWindow.check(hop, sequence)) {
+        accepted += hopWindow.accept(hop, sequence); // authenticated here
+      }
+    }
+    // This hop's packets replayed at once
+    for (int i = 0; i < PACKETS_PER_HOP; i++) {
+      replays++;
+      uint32_t startCycles = cycleCount();
+      bool drop = !receiverNonces.expand(hop, headers[i], nonce, &sequence) ||
+                  !hopWindow.check(hop, sequence);
+      dropCycles += cycleCount() - startCycles;
+      dropped += drop;
+    }
+  }
+  Serial.print("    accepted ");
+  Serial.print(accepted);
+  Serial.print("/");
+  Serial.print(HOPS * PACKETS_PER_HOP);
+  Serial.print(", replays dropped before crypto ");
+  Serial.print(dropped);
+  Serial.print("/");
+  Serial.print(replays);
+  Serial.print(", ");
+  Serial.print((float)dropCycles / replays, 1);
+  Serial.println(" cycles each");
+}
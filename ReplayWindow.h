@@ -0,0 +1,191 @@
+#ifndef REPLAY_WINDOW_H
+#define REPLAY_WINDOW_H
+
+#include <stdint.h>
+#include <string.h>
+
+// Sliding-window anti-replay filter over a link's packet sequence numbers,
+// as in IPsec (RFC 4303 section 3.4.3).
+//
+// The window covers the WindowBits sequence numbers up to the highest one
+// accepted. check() runs before any MAC or decryption work and rejects a
+// packet that is older than the window or whose bit is already set, with a
+// compare and a single bit test, so a replay flood costs the receiver no
+// crypto. accept() records a packet once it has authenticated; forged
+// packets never move the window.
+//
+// The bitmap is a ring of 32-bit words with one word more than the window
+// (RFC 6479): moving the window forward clears the words it enters instead
+// of shifting the whole bitmap, so accept() is O(1) per word advanced and
+// at most WindowBits / 32 + 1 word writes for a large jump.
+
+#define REPLAY_WINDOW_MIN_BITS 64
+#define REPLAY_WINDOW_MAX_BITS 1024
+
+struct ReplayStats {
+  uint32_t accepted;
+  uint32_t duplicates; // sequence number already accepted
+  uint32_t tooOld;     // sequence number behind the window
+};
+
+template <uint16_t WindowBits>
+class ReplayWindow {
+  static_assert(WindowBits >= REPLAY_WINDOW_MIN_BITS && WindowBits <= REPLAY_WINDOW_MAX_BITS &&
+                WindowBits % 32 == 0, "replay window must be 64 to 1024 bits, in whole words");
+
+public:
+  ReplayWindow() {
+    reset();
+    resetStats();
+  }
+
+  // New key epoch: sequence numbers start again from 0
+  void reset() {
+    memset(bitmap, 0, sizeof(bitmap));
+    highest = 0;
+    started = false;
+  }
+
+  // Cheap pre-crypto check; false if the packet must be dropped
+  bool check(uint32_t sequence) {
+    if (!started || sequence > highest) {
+      return true;
+    }
+    if (highest - sequence >= WindowBits) {
+      stats.tooOld++;
+      return false;
+    }
+    if (bitmap[wordIndex(sequence)] & bitMask(sequence)) {
+      stats.duplicates++;
+      return false;
+    }
+    return true;
+  }
+
+  // Record an authenticated packet; returns false if it is a replay after all
+  bool accept(uint32_t sequence) {
+    if (!check(sequence)) {
+      return false;
+    }
+    if (!started || sequence > highest) {
+      advance(sequence);
+    }
+    bitmap[wordIndex(sequence)] |= bitMask(sequence);
+    stats.accepted++;
+    return true;
+  }
+
+  uint32_t highestAccepted() const {
+    return highest;
+  }
+
+  const ReplayStats &statistics() const {
+    return stats;
+  }
+
+  void resetStats() {
+    memset(&stats, 0, sizeof(stats));
+  }
+
+private:
+  static const uint16_t WORDS = WindowBits / 32 + 1;
+
+  static uint16_t wordIndex(uint32_t sequence) {
+    return (sequence >> 5) % WORDS;
+  }
+
+  static uint32_t bitMask(uint32_t sequence) {
+    return (uint32_t)1 << (sequence & 31);
+  }
+
+  // Clear the words between the old highest and the new one
+  void advance(uint32_t sequence) {
+    uint32_t fromWord = highest >> 5;
+    uint32_t toWord = sequence >> 5;
+    if (!started || toWord - fromWord >= WORDS) {
+      memset(bitmap, 0, sizeof(bitmap));
+    } else {
+      for (uint32_t word = fromWord + 1; word <= toWord; word++) {
+        bitmap[word % WORDS] = 0;
+      }
+    }
+    highest = sequence;
+    started = true;
+  }
+
+  uint32_t bitmap[WORDS];
+  uint32_t highest;
+  bool started;
+  ReplayStats stats;
+};
+
+// Replay filter for sequence numbers that restart in every hop
+// (ImplicitNonce.h): packets are identified by (hop, sequence), where hop is
+// the hop the packet was received in. A packet from a hop before the latest
+// one accepted is dropped with a compare, before any crypto, and never moves
+// the window; within the current hop the sequence number goes through a
+// ReplayWindow, which is only cleared when an authenticated packet moves
+// the hop forward.
+template <uint16_t WindowBits>
+class HopReplayWindow {
+public:
+  HopReplayWindow() : currentHop(0), started(false), oldHops(0) {}
+
+  // New key epoch
+  void reset() {
+    window.reset();
+    currentHop = 0;
+    started = false;
+  }
+
+  // Cheap pre-crypto check; false if the packet must be dropped
+  bool check(uint64_t hop, uint32_t sequence) {
+    if (!started || hop > currentHop) {
+      return true;
+    }
+    if (hop < currentHop) {
+      oldHops++;
+      return false;
+    }
+    return window.check(sequence);
+  }
+
+  // Record an authenticated packet; returns false if it is a replay after all
+  bool accept(uint64_t hop, uint32_t sequence) {
+    if (!check(hop, sequence)) {
+      return false;
+    }
+    if (!started || hop > currentHop) {
+      window.reset();
+      currentHop = hop;
+      started = true;
+    }
+    return window.accept(sequence);
+  }
+
+  uint64_t hop() const {
+    return currentHop;
+  }
+
+  const ReplayStats &statistics() const {
+    return window.statistics();
+  }
+
+  // Packets dropped for a hop before the current one
+  uint32_t oldHopCount() const {
+    return oldHops;
+  }
+
+  void resetStats() {
+    window.resetStats();
+    oldHops = 0;
+  }
+
+private:
+  ReplayWindow<WindowBits> window;
+  uint64_t currentHop;
+  bool started;
+  uint32_t oldHops;
+};
+
+#endif // REPLAY_WINDOW_H
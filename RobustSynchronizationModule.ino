@@ -1,22 +1,39 @@
 #include <SPI.h>
+#include "HopClock.h"
 
 #define SYNC_PACKET_PIN 10
 #define PACKET_HEADER 0xAA
+#define HOP_DWELL_SHIFT 15 // 2^15 ticks of the 32.768 kHz hop clock = 1 s dwell
 #define MAX_RETRANSMISSIONS 3
 
 const uint8_t channels[] = {1, 6, 11, 16, 21, 26};
+#define CHANNEL_COUNT ((uint8_t)(sizeof(channels) / sizeof(channels[0])))
 
 struct SyncPacket {
   uint8_t header;
   uint32_t sequenceNumber;
-  uint32_t timestamp;
+  uint64_t timestamp; // network time in hop clock ticks
   uint16_t crc;
 };
 
-unsigned long localTime;
+HopClock hopClock;
 unsigned long localSeq;
 bool isMaster;
 
+#define NO_HOP_SLOT 0xFFFFFFFFFFFFFFFFULL
+#define BUS_STATS_INTERVAL_HOPS 60 // Print channel command statistics this often
+
+// Hop slot whose channel is currently set; setChannel() is only issued
+// when the slot changes, not on every pass through loop()
+uint64_t currentHopSlot = NO_HOP_SLOT;
+uint8_t channelIndex = 0; // index of the channel for currentHopSlot
+uint64_t lastSyncHop = NO_HOP_SLOT;
+
+// Counters for measuring the channel command savings
+unsigned long loopPasses = 0;
+unsigned long hopsCommitted = 0;
+unsigned long channelCommands = 0;
+
 void setup() {
   Serial.begin(115200);
   while (!Serial);
@@ -25,14 +42,15 @@ void setup() {
 
   isMaster = true; // Example: Set as master.
 
-  localTime = millis();
+  hopClock.begin(HOP_DWELL_SHIFT);
   localSeq = 0;
 }
 
 void loop() {
   if (isMaster) {
-    if (millis() - localTime > 1000) {
-      localTime += 1000;
+    uint64_t hop = hopClock.hopIndex();
+    if (hop != lastSyncHop) {
+      lastSyncHop = hop;
       localSeq++;
       sendSyncPacket();
     }
@@ -40,7 +58,12 @@ void loop() {
     SyncPacket packet = receiveSyncPacket();
     if (packet.header == PACKET_HEADER) {
       if (checkCRC(packet)) {
-        localTime = packet.timestamp + (millis() - packet.timestamp) / 2;
+        // Meet the master halfway, as with millis() before: the packet arrives
+        // some propagation delay after it was stamped, and splitting the
+        // difference with the local clock allows for part of it without a
+        // round-trip measurement
+        int64_t behind = (int64_t)(hopClock.now() - packet.timestamp);
+        hopClock.setTime(packet.timestamp + behind / 2);
         localSeq = packet.sequenceNumber;
       } else {
         requestRetransmission();
@@ -48,8 +71,28 @@ void loop() {
     }
   }
 
-  uint8_t channelIndex = (localTime / 1000) % sizeof(channels);
-  setChannel(channels[channelIndex]);
+  // Change channel only when the hop slot changes
+  loopPasses++;
+  uint64_t hopSlot = hopClock.hopIndex(); // shift only, no division
+  if (hopSlot != currentHopSlot) {
+    // The channel index wraps round as the slot steps; only a jump (at
+    // start, after a resync or a long loop pass) works it out again
+    if (currentHopSlot != NO_HOP_SLOT && hopSlot == currentHopSlot + 1) {
+      channelIndex = channelIndex + 1 < CHANNEL_COUNT ? channelIndex + 1 : 0;
+    } else {
+      channelIndex = channelIndexFor(hopSlot);
+    }
+    currentHopSlot = hopSlot;
+    setChannel(channels[channelIndex]);
+    hopsCommitted++;
+    if (hopsCommitted % BUS_STATS_INTERVAL_HOPS == 0) {
+      printBusStats();
+    }
+  }
+}
+
+void TC0_Handler() {
+  hopClock.handleInterrupt();
 }
 
 void sendSyncPacket(uint8_t retransmissions = 0) {
@@ -59,7 +102,7 @@ void sendSyncPacket(uint8_t retransmissions = 0) {
   SyncPacket packet;
   packet.header = PACKET_HEADER;
   packet.sequenceNumber = localSeq;
-  packet.timestamp = localTime;
+  packet.timestamp = hopClock.now();
   packet.crc = calculateCRC(packet);
 
   // Send packet logic here
@@ -78,8 +121,17 @@ SyncPacket receiveSyncPacket() {
   return packet;
 }
 
+// Channel index for any hop slot in 32-bit arithmetic (the Cortex-M4
+// divides 32-bit values in hardware, 64-bit ones in a library call)
+uint8_t channelIndexFor(uint64_t hopSlot) {
+  const uint32_t wrap = (uint32_t)(0x100000000ULL % CHANNEL_COUNT); // 2^32 mod count
+  uint32_t high = (uint32_t)(hopSlot >> 32) % CHANNEL_COUNT;
+  return (uint8_t)((high * wrap + (uint32_t)hopSlot % CHANNEL_COUNT) % CHANNEL_COUNT);
+}
+
 void setChannel(uint8_t channel) {
   // Logic to change to the specified channel
+  channelCommands++;
 }
 
 uint16_t calculateCRC(SyncPacket packet) {
@@ -103,3 +155,13 @@ bool waitForAck() {
   // Return true if acknowledgment received, else return false
   return true; // placeholder
 }
+
+// Before edge-triggering, every loop pass issued a channel command
+void printBusStats() {
+  Serial.print("Loop passes: ");
+  Serial.print(loopPasses);
+  Serial.print(", hops: ");
+  Serial.print(hopsCommitted);
+  Serial.print(", channel commands: ");
+  Serial.println(channelCommands);
+}
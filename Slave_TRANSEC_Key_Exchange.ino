@@ -1,31 +1,141 @@
 // Slave.ino
-#include <SPI.h>
+#include <wiring_private.h>
+#include "KeyFillSlave.h"
+#include "KeyAgreement.h"
+#include "EntropyPool.h"
+#include "KeyWrap.h"
 
 #define KEY_LENGTH 32
-#define SS_PIN 10
+
+// SERCOM1 pins (see SpiSlave.h). The Metro M4 variant.cpp maps D13 to
+// PA16, D12 to PA17, D10 to PA18 and D11 to PA19, which are SERCOM1 PAD0 to
+// PAD3 on peripheral C (PIO_SERCOM). Wire the Master's MOSI to D13, SCK to
+// D12, its slave select for this board to D10, and D11 back to its MISO.
+// D13 also drives the red LED, which only loads the MOSI line.
+#define SLAVE_MOSI_PIN 13 // PA16, SERCOM1 PAD0
+#define SLAVE_SCK_PIN 12  // PA17, SERCOM1 PAD1
+#define SLAVE_SS_PIN 10   // PA18, SERCOM1 PAD2
+#define SLAVE_MISO_PIN 11 // PA19, SERCOM1 PAD3
+
+#define TRANSEC_KEY_ID 0 // Slot in the key table holding the TRANSEC key
+
+// Shared with the Master ahead of time; authenticates the key agreement.
+// Example bytes only: load the real pairing key at provisioning.
+const uint8_t PAIRING_KEY[32] = {
+  0xA5, 0x3C, 0x5E, 0x91, 0x0D, 0x7B, 0x22, 0xE8, 0x4F, 0x16, 0xC3, 0x89, 0x70, 0xBD, 0x2A, 0x5F,
+  0x93, 0x08, 0xE1, 0x6C, 0x47, 0xDA, 0x35, 0xB2, 0x1E, 0x84, 0x6B, 0xF0, 0x59, 0xC7, 0x0A, 0x3D
+};
 
 uint8_t TRANSECKey[KEY_LENGTH];
+uint8_t sessionKey[SESSION_KEY_SIZE];
+bool sessionEstablished = false;
+uint8_t agreementResponse[X25519_KEY_SIZE + KEY_AGREEMENT_TAG_SIZE];
+
+Sercom1SpiSlavePort spiPort;
+SpiSlave spiSlave(spiPort);
+KeyFillSlave keyFill(spiSlave);
+EntropyPool entropyPool;
+EphemeralKeyPool keyPool(entropyPool);
+KeyAgreement agreement;
 
 void setup() {
   Serial.begin(115200);
   while (!Serial); // wait for serial port to connect
-  
-  // Setup SPI
-  SPI.begin();
-  pinMode(SS_PIN, INPUT);
-
-  // Wait for TRANSEC key from the master
-  while (digitalRead(SS_PIN) == HIGH);
-  SPI.transfer(TRANSECKey, KEY_LENGTH);
-  while (digitalRead(SS_PIN) == LOW);
-  
-  Serial.println("TRANSEC key received:");
-  for (int i = 0; i < KEY_LENGTH; i++) {
-    Serial.print(TRANSECKey[i], HEX);
-    Serial.print(" ");
+
+  // Start collecting TRNG output for ephemeral keys
+  entropyPool.begin();
+
+  // Run the SERCOM as an SPI slave; frames arrive by DMA
+  pinPeripheral(SLAVE_MOSI_PIN, PIO_SERCOM);
+  pinPeripheral(SLAVE_SCK_PIN, PIO_SERCOM);
+  pinPeripheral(SLAVE_SS_PIN, PIO_SERCOM);
+  pinPeripheral(SLAVE_MISO_PIN, PIO_SERCOM);
+  if (!spiSlave.begin()) {
+    Serial.println("No DMA channel available for the SPI slave.");
+    while (true);
   }
-  Serial.println();
+  keyFill.begin();
+  keyFill.onRequest(handleRequest);
+  Serial.println("Waiting for TRANSEC key...");
 }
 
 void loop() {
+  // Check and acknowledge each frame once slave select has gone high
+  uint16_t keyId;
+  uint32_t errors = keyFill.frameErrorCount();
+  if (!keyFill.service(&keyId)) {
+    if (keyFill.frameErrorCount() != errors) {
+      Serial.println("Corrupt key frame, NAK sent.");
+    }
+    // Idle: keep ephemeral key pairs ready for the next key agreement
+    keyPool.refill();
+    return;
+  }
+  if (keyId != TRANSEC_KEY_ID) {
+    return;
+  }
+
+  // The key table keeps the key wrapped; unwrap it only to load it
+  if (!loadTRANSECKey()) {
+    Serial.println("TRANSEC key received but could not be unwrapped, discarded.");
+    return;
+  }
+  Serial.println("TRANSEC key received and unwrapped.");
+}
+
+// Unwrap the TRANSEC key from the key table with the session key as KEK
+bool loadTRANSECKey() {
+  if (!sessionEstablished || !keyFill.hasKey(TRANSEC_KEY_ID)) {
+    return false;
+  }
+  KeyWrap keyWrap;
+  keyWrap.setKek(sessionKey, SESSION_KEY_SIZE);
+  bool unwrapped = keyWrap.unwrap(keyFill.key(TRANSEC_KEY_ID), KEY_FILL_KEY_LENGTH, TRANSECKey);
+  keyWrap.clear();
+  return unwrapped;
+}
+
+// Key agreement requests from the Master. Runs from loop() via keyFill.service().
+bool handleRequest(const KeyFrame &frame, const uint8_t **response, size_t *responseLength) {
+  switch (frame.type) {
+    case KEY_FRAME_TYPE_AGREE_INIT: {
+      // Answer with our public key and confirmation tag
+      uint8_t privateKey[X25519_KEY_SIZE];
+      if (frame.length != X25519_KEY_SIZE || !keyPool.take(privateKey, agreementResponse)) {
+        return false;
+      }
+      sessionEstablished = false;
+      agreement.begin(KEY_AGREEMENT_RESPONDER, PAIRING_KEY, privateKey, agreementResponse);
+      clean(privateKey, sizeof(privateKey));
+      if (!agreement.receivePublicKey(frame.payload)) {
+        agreement.clear();
+        return false;
+      }
+      agreement.confirmationTag(agreementResponse + X25519_KEY_SIZE);
+      *response = agreementResponse;
+      *responseLength = sizeof(agreementResponse);
+      return true;
+    }
+    case KEY_FRAME_TYPE_AGREE_CONFIRM:
+      if (frame.length != KEY_AGREEMENT_TAG_SIZE || !agreement.verifyConfirmation(frame.payload)) {
+        agreement.clear();
+        Serial.println("Key agreement failed: Master not authenticated.");
+        return false;
+      }
+      memcpy(sessionKey, agreement.sessionKey(), SESSION_KEY_SIZE);
+      sessionEstablished = true;
+      agreement.clear();
+      Serial.println("Authenticated session key established.");
+      return true;
+    default:
+      return false;
+  }
+}
+
+void TRNG_Handler() {
+  entropyPool.handleInterrupt();
+}
+
+void SERCOM1_1_Handler() {
+  spiSlave.handleInterrupt();
 }
@@ -0,0 +1,264 @@
+#ifndef SPI_SLAVE_H
+#define SPI_SLAVE_H
+
+#include <Arduino.h>
+
+// SERCOM SPI slave for the SAMD51 with DMA receive.
+//
+// The Arduino SPI library only drives the SERCOM as a master, so a board
+// receiving keys has to run it as a slave itself. A DMA channel triggered by
+// the SERCOM's RX flag copies each byte into a frame buffer as the master
+// clocks it in, so the CPU does nothing during the transfer. In slave mode
+// the SERCOM raises TXC when slave select goes high; that interrupt ends the
+// frame, hands the buffer to loop() and re-arms DMA into the second buffer,
+// so a new frame can arrive before the previous one has been read.
+//
+// The slave answers through a status byte that is preloaded before every
+// transaction, so the master reads it as the first byte of whatever it sends
+// next. Handing over a frame switches the status to the busy value until
+// loop() sets the result. With PLOADEN only the first byte written to DATA
+// while slave select is high is preloaded, so after a hand-over nothing is
+// written until loop() sets the result, which then shows in the very next
+// transaction. If the master comes back sooner, the shift register still
+// holds the frame's last byte: masters end every frame with a zero pad
+// byte so that reads as busy. Transactions that are a single byte or start
+// with a zero byte are status polls: they read the status and are not
+// handed over. A result can carry a response, which a second DMA channel shifts out
+// right after the status byte of one following transaction; the master has
+// to clock exactly 1 + length bytes for it so nothing is left in DATA.
+//
+// Pads (SPI mode 0, MSB first): PAD0 MOSI in, PAD1 SCK in, PAD2 SS in,
+// PAD3 MISO out.
+//
+// The slave only reaches the SERCOM and its DMA channels through the
+// SpiSlavePort interface: Sercom1SpiSlavePort on the SAMD51, or a simulated
+// bus that plays the master and calls handleInterrupt() itself
+// (KeyFillBusBenchmark.ino). On the board the sketch muxes the pins to the
+// SERCOM and must forward the TXC interrupt:
+//   void SERCOM1_1_Handler() { spiSlave.handleInterrupt(); }
+
+#define SPI_SLAVE_BUFFER_SIZE 64
+#define SPI_SLAVE_POLL_BYTE 0x00 // first byte of a status poll
+
+// A SERCOM in SPI slave mode with PLOADEN, one DMA channel from DATA into
+// a receive buffer and one from a response into DATA
+class SpiSlavePort {
+public:
+  virtual ~SpiSlavePort() {}
+  // Set up and enable the SERCOM, receiving the first frame into buffer.
+  // Returns false if no DMA channel is free.
+  virtual bool begin(uint8_t *buffer, size_t length) = 0;
+  // Byte shifted out first when slave select next goes low
+  virtual void setData(uint8_t value) = 0;
+  // True, clearing it, if slave select has gone high since the last call
+  virtual bool takeSelectEnd() = 0;
+  // Stop both DMA channels; returns the bytes received into the buffer
+  virtual size_t stopReceive() = 0;
+  virtual void receive(uint8_t *buffer, size_t length) = 0;
+  // Shift length bytes out behind the byte in DATA, one per byte clocked
+  virtual void transmit(const uint8_t *data, size_t length) = 0;
+};
+
+#if defined(__SAMD51__)
+#include <Adafruit_ZeroDMA.h>
+
+#define SPI_SLAVE_SERCOM SERCOM1
+#define SPI_SLAVE_GCLK_ID SERCOM1_GCLK_ID_CORE
+#define SPI_SLAVE_TXC_IRQn SERCOM1_1_IRQn // TXC is on the SERCOMn_1 line
+#define SPI_SLAVE_DMA_TRIGGER SERCOM1_DMAC_ID_RX
+#define SPI_SLAVE_TX_DMA_TRIGGER SERCOM1_DMAC_ID_TX
+#define SPI_SLAVE_DIPO 0 // data in on PAD0
+#define SPI_SLAVE_DOPO 2 // data out on PAD3, SCK on PAD1, SS on PAD2
+
+// SERCOM1, which the Metro M4 leaves free (SPI is on SERCOM2, Serial1 on
+// SERCOM3 and Wire on SERCOM5)
+class Sercom1SpiSlavePort : public SpiSlavePort {
+public:
+  Sercom1SpiSlavePort() : descriptor(NULL), txDescriptor(NULL), receiveLength(0) {}
+
+  bool begin(uint8_t *buffer, size_t length) {
+    MCLK->APBAMASK.reg |= MCLK_APBAMASK_SERCOM1;
+    GCLK->PCHCTRL[SPI_SLAVE_GCLK_ID].reg = GCLK_PCHCTRL_GEN_GCLK1 | GCLK_PCHCTRL_CHEN;
+    while (!(GCLK->PCHCTRL[SPI_SLAVE_GCLK_ID].reg & GCLK_PCHCTRL_CHEN));
+
+    SercomSpi &spi = SPI_SLAVE_SERCOM->SPI;
+    spi.CTRLA.reg = SERCOM_SPI_CTRLA_SWRST;
+    while (spi.SYNCBUSY.bit.SWRST);
+    spi.CTRLA.reg = SERCOM_SPI_CTRLA_MODE(2) | SERCOM_SPI_CTRLA_DIPO(SPI_SLAVE_DIPO) |
+                    SERCOM_SPI_CTRLA_DOPO(SPI_SLAVE_DOPO);
+    // PLOADEN: the byte in DATA is shifted out as soon as SS goes low
+    spi.CTRLB.reg = SERCOM_SPI_CTRLB_RXEN | SERCOM_SPI_CTRLB_PLOADEN;
+    while (spi.SYNCBUSY.bit.CTRLB);
+
+    if (dma.allocate() != DMA_STATUS_OK || txDma.allocate() != DMA_STATUS_OK) {
+      return false;
+    }
+    txDma.setTrigger(SPI_SLAVE_TX_DMA_TRIGGER);
+    txDma.setAction(DMA_TRIGGER_ACTON_BEAT);
+    txDescriptor = txDma.addDescriptor(buffer, (void *)&spi.DATA.reg, 1, DMA_BEAT_SIZE_BYTE,
+                                       true, false);
+    dma.setTrigger(SPI_SLAVE_DMA_TRIGGER);
+    dma.setAction(DMA_TRIGGER_ACTON_BEAT);
+    descriptor = dma.addDescriptor((void *)&spi.DATA.reg, buffer, length, DMA_BEAT_SIZE_BYTE,
+                                   false, true);
+    receiveLength = length;
+    dma.startJob();
+
+    spi.INTFLAG.reg = SERCOM_SPI_INTFLAG_TXC;
+    spi.INTENSET.reg = SERCOM_SPI_INTENSET_TXC;
+    NVIC_SetPriority(SPI_SLAVE_TXC_IRQn, 1);
+    NVIC_EnableIRQ(SPI_SLAVE_TXC_IRQn);
+
+    spi.CTRLA.bit.ENABLE = 1;
+    while (spi.SYNCBUSY.bit.ENABLE);
+    return true;
+  }
+
+  void setData(uint8_t value) {
+    SPI_SLAVE_SERCOM->SPI.DATA.reg = value;
+  }
+
+  bool takeSelectEnd() {
+    SercomSpi &spi = SPI_SLAVE_SERCOM->SPI;
+    if (!(spi.INTFLAG.reg & SERCOM_SPI_INTFLAG_TXC)) {
+      return false;
+    }
+    spi.INTFLAG.reg = SERCOM_SPI_INTFLAG_TXC;
+    spi.STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+    return true;
+  }
+
+  size_t stopReceive() {
+    // Stopping the channel writes its remaining beat count back
+    dma.abort();
+    txDma.abort();
+    DmacDescriptor *writeback = (DmacDescriptor *)DMAC->WRBADDR.reg;
+    return receiveLength - writeback[dma.getChannel()].BTCNT.reg;
+  }
+
+  void receive(uint8_t *buffer, size_t length) {
+    dma.changeDescriptor(descriptor, (void *)&SPI_SLAVE_SERCOM->SPI.DATA.reg, buffer, length);
+    receiveLength = length;
+    dma.startJob();
+  }
+
+  void transmit(const uint8_t *data, size_t length) {
+    txDma.changeDescriptor(txDescriptor, (void *)data, (void *)&SPI_SLAVE_SERCOM->SPI.DATA.reg,
+                           length);
+    txDma.startJob();
+  }
+
+private:
+  Adafruit_ZeroDMA dma;
+  Adafruit_ZeroDMA txDma;
+  DmacDescriptor *descriptor;
+  DmacDescriptor *txDescriptor;
+  size_t receiveLength;
+};
+#endif
+
+class SpiSlave {
+public:
+  SpiSlave(SpiSlavePort &slavePort)
+    : port(slavePort), receiving(0), ready(false), readyLength(0), droppedFrames(0), status(0),
+      busyStatus(0), response(NULL), responseLength(0), responsePending(false) {}
+
+  // Returns false if no DMA channel is free
+  bool begin() {
+    if (!port.begin(buffers[receiving], SPI_SLAVE_BUFFER_SIZE)) {
+      return false;
+    }
+    port.setData(status);
+    return true;
+  }
+
+  // True when a complete frame is waiting; frame and length receive it.
+  // Call release() once the frame has been read.
+  bool available(const uint8_t **frame, size_t *length) {
+    if (!ready) {
+      return false;
+    }
+    *frame = buffers[1 - receiving];
+    *length = readyLength;
+    return true;
+  }
+
+  void release() {
+    ready = false;
+  }
+
+  // Byte shifted out at the start of every following transaction. With a
+  // response (which must stay valid until it has been read), the status and
+  // response appear together after the next transaction ends, so the master
+  // never sees the new status without the response behind it.
+  void setStatus(uint8_t value, const uint8_t *responseData = NULL, size_t length = 0) {
+    noInterrupts();
+    status = value;
+    response = responseData;
+    responseLength = length;
+    responsePending = length > 0;
+    interrupts();
+    if (!responsePending) {
+      // Preloaded if nothing has been since slave select last went high;
+      // otherwise it shows after the next transaction
+      port.setData(value);
+    }
+  }
+
+  // Status shown while a handed-over frame has not been processed
+  void setBusyStatus(uint8_t value) {
+    busyStatus = value;
+  }
+
+  // Frames lost because loop() had not released the previous one
+  uint32_t droppedFrameCount() const {
+    return droppedFrames;
+  }
+
+  // Slave select went high: the frame is complete
+  void handleInterrupt() {
+    if (!port.takeSelectEnd()) {
+      return;
+    }
+    size_t received = port.stopReceive();
+
+    bool handedOver = false;
+    if (received <= 1 || buffers[receiving][0] == SPI_SLAVE_POLL_BYTE) {
+      // Status poll: nothing to hand over
+    } else if (ready) {
+      // Previous frame not read yet: reuse the same buffer
+      droppedFrames++;
+    } else {
+      readyLength = received;
+      receiving = 1 - receiving;
+      ready = true;
+      status = busyStatus;
+      handedOver = true;
+    }
+    // After a hand-over the preload is left to setStatus() (the pad byte
+    // reads as busy until then), unless a response has to go out behind it
+    if (!handedOver || responsePending) {
+      port.setData(status);
+    }
+    if (responsePending) {
+      port.transmit(response, responseLength);
+      responsePending = false;
+    }
+    port.receive(buffers[receiving], SPI_SLAVE_BUFFER_SIZE);
+  }
+
+private:
+  SpiSlavePort &port;
+  uint8_t buffers[2][SPI_SLAVE_BUFFER_SIZE];
+  volatile uint8_t receiving;
+  volatile bool ready;
+  volatile size_t readyLength;
+  volatile uint32_t droppedFrames;
+  volatile uint8_t status;
+  uint8_t busyStatus;
+  const uint8_t *response;
+  size_t responseLength;
+  bool responsePending;
+};
+
+#endif // SPI_SLAVE_H
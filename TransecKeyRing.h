@@ -0,0 +1,182 @@
+#ifndef TRANSEC_KEY_RING_H
+#define TRANSEC_KEY_RING_H
+
+#include "KeyHierarchy.h"
+#include "HopSequence.h"
+#include "HopPermutation.h"
+
+// Active/next TRANSEC key slots for hitless rekeying.
+//
+// The active slot serves the running hop sequence. A new key is loaded into
+// the next slot together with the hop index at which it takes effect, and
+// prepare() (called from loop()) extracts it, derives its epoch subkeys and
+// keys its hop generators one step at a time in the background. channel()
+// picks the slot by hop index, so hops before the activation hop use the old
+// key and hops from it onward use the new one: no hop is lost and neither
+// end has to restart. Once the activation hop is reached, advance() promotes
+// the next slot and wipes the old key. With permutation hopping the new
+// key's epochs start at its activation hop (HopPermutation.h).
+
+class TransecKeyRing {
+public:
+  TransecKeyRing(uint32_t channelCount, bool permutationHopping)
+    : usePermutation(permutationHopping), active(0),
+      permutations{HopPermutation(channelCount), HopPermutation(channelCount)},
+      channelMap(channelCount) {
+    slots[0].state = SLOT_EMPTY;
+    slots[1].state = SLOT_EMPTY;
+  }
+
+  // Load the first key; it is active from hop 0
+  void begin(const uint8_t *masterKey, uint64_t epoch) {
+    active = 0;
+    load(active, masterKey, epoch, 0);
+    finishPreparing(active);
+    slots[1 - active].state = SLOT_EMPTY;
+  }
+
+  // Stage a key to take effect at activationHop. Returns false if a
+  // rollover is already pending.
+  bool scheduleNext(const uint8_t *masterKey, uint64_t epoch, uint64_t activationHop) {
+    uint8_t next = 1 - active;
+    if (slots[next].state != SLOT_EMPTY) {
+      return false;
+    }
+    load(next, masterKey, epoch, activationHop);
+    return true;
+  }
+
+  // Background work for a pending key: one step per call
+  void prepare() {
+    uint8_t next = 1 - active;
+    if (slots[next].state != SLOT_EMPTY && slots[next].state != SLOT_READY) {
+      prepareStep(next);
+    }
+  }
+
+  // Channel for hop n under whichever key is in effect at that hop
+  uint32_t channel(uint64_t hop) {
+    uint8_t slot = slotForHop(hop);
+    finishPreparing(slot);
+    if (usePermutation) {
+      return permutations[slot].channel(hop);
+    }
+    return sequences[slot].channel(hop, channelMap);
+  }
+
+  // Subkey in effect at hop n, e.g. for traffic keys
+  const uint8_t *subkey(uint64_t hop, KeyPurpose purpose) {
+    uint8_t slot = slotForHop(hop);
+    finishPreparing(slot);
+    return slots[slot].keys.subkey(slots[slot].epoch, purpose);
+  }
+
+  // Promote the next slot once the current hop has reached its activation
+  // hop, and wipe the key it replaces
+  void advance(uint64_t currentHop) {
+    uint8_t next = 1 - active;
+    if (slots[next].state == SLOT_EMPTY || currentHop < slots[next].activationHop) {
+      return;
+    }
+    finishPreparing(next);
+    wipe(active);
+    active = next;
+  }
+
+  bool rolloverPending() const {
+    return slots[1 - active].state != SLOT_EMPTY;
+  }
+
+  uint64_t activeEpoch() const {
+    return slots[active].epoch;
+  }
+
+  uint64_t nextActivationHop() const {
+    return slots[1 - active].activationHop;
+  }
+
+private:
+  enum SlotState {
+    SLOT_EMPTY,
+    SLOT_LOADED,    // master key copied, nothing derived yet
+    SLOT_EXTRACTED, // HKDF extract done
+    SLOT_DERIVED,   // epoch subkeys derived
+    SLOT_READY      // hop generators keyed and warmed
+  };
+
+  struct KeySlot {
+    SlotState state;
+    uint8_t masterKey[MASTER_KEY_LENGTH];
+    uint64_t epoch;
+    uint64_t activationHop;
+    KeyHierarchy keys;
+  };
+
+  uint8_t slotForHop(uint64_t hop) const {
+    uint8_t next = 1 - active;
+    if (slots[next].state != SLOT_EMPTY && hop >= slots[next].activationHop) {
+      return next;
+    }
+    return active;
+  }
+
+  void load(uint8_t slot, const uint8_t *masterKey, uint64_t epoch, uint64_t activationHop) {
+    memcpy(slots[slot].masterKey, masterKey, MASTER_KEY_LENGTH);
+    slots[slot].epoch = epoch;
+    slots[slot].activationHop = activationHop;
+    slots[slot].state = SLOT_LOADED;
+  }
+
+  void prepareStep(uint8_t slot) {
+    KeySlot &s = slots[slot];
+    switch (s.state) {
+      case SLOT_LOADED:
+        s.keys.begin(s.masterKey);
+        clean(s.masterKey, sizeof(s.masterKey));
+        s.state = SLOT_EXTRACTED;
+        break;
+      case SLOT_EXTRACTED:
+        s.keys.prepare(s.epoch);
+        s.state = SLOT_DERIVED;
+        break;
+      case SLOT_DERIVED: {
+        const uint8_t *hopKey = s.keys.subkey(s.epoch, KEY_PURPOSE_HOP);
+        sequences[slot].begin(hopKey);
+        permutations[slot].begin(hopKey, s.activationHop);
+        s.state = SLOT_READY;
+        // Warm the generator state for the first hop under this key
+        if (usePermutation) {
+          permutations[slot].channel(s.activationHop);
+        } else {
+          sequences[slot].channel(s.activationHop, channelMap);
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  void finishPreparing(uint8_t slot) {
+    while (slots[slot].state != SLOT_READY && slots[slot].state != SLOT_EMPTY) {
+      prepareStep(slot);
+    }
+  }
+
+  void wipe(uint8_t slot) {
+    slots[slot].keys.clear();
+    sequences[slot].clear();
+    permutations[slot].clear();
+    clean(slots[slot].masterKey, sizeof(slots[slot].masterKey));
+    slots[slot].state = SLOT_EMPTY;
+  }
+
+  bool usePermutation;
+  uint8_t active;
+  KeySlot slots[2];
+  HopSequence sequences[2];
+  HopPermutation permutations[2];
+  ChannelMap channelMap;
+};
+
+#endif // TRANSEC_KEY_RING_H
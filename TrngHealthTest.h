@@ -0,0 +1,82 @@
+#ifndef TRNG_HEALTH_TEST_H
+#define TRNG_HEALTH_TEST_H
+
+#include <stdint.h>
+
+// Continuous SP 800-90B health tests on the TRNG output stream.
+//
+// Each 32-bit TRNG word is treated as four 8-bit samples and run through the
+// Repetition Count Test and the Adaptive Proportion Test as it arrives. Both
+// tests keep a few bytes of state and do constant work per sample, so they
+// can run inside the TRNG interrupt. Cutoffs assume a conservative claim of
+// 4 bits of min-entropy per byte with a false alarm rate of 2^-20. An alarm
+// latches until reset().
+
+#define TRNG_HEALTH_RCT_CUTOFF 6    // 1 + ceil(20 / H) for H = 4
+#define TRNG_HEALTH_APT_WINDOW 512  // samples per adaptive proportion window
+#define TRNG_HEALTH_APT_CUTOFF 62   // SP 800-90B Table 2, W = 512, H = 4
+
+class TrngHealthTest {
+public:
+  TrngHealthTest() {
+    reset();
+  }
+
+  void reset() {
+    alarm = false;
+    rctValue = 0;
+    rctCount = 0;
+    aptValue = 0;
+    aptMatches = 0;
+    aptSamples = 0;
+  }
+
+  // Returns false once either test has raised an alarm
+  bool addWord(uint32_t word) {
+    addSample((uint8_t)word);
+    addSample((uint8_t)(word >> 8));
+    addSample((uint8_t)(word >> 16));
+    addSample((uint8_t)(word >> 24));
+    return !alarm;
+  }
+
+  bool failed() const {
+    return alarm;
+  }
+
+private:
+  void addSample(uint8_t sample) {
+    // Repetition Count Test: too many identical samples in a row
+    if (rctCount > 0 && sample == rctValue) {
+      if (++rctCount >= TRNG_HEALTH_RCT_CUTOFF) {
+        alarm = true;
+      }
+    } else {
+      rctValue = sample;
+      rctCount = 1;
+    }
+
+    // Adaptive Proportion Test: the window's first sample occurring too
+    // often within the window
+    if (aptSamples == 0) {
+      aptValue = sample;
+      aptMatches = 1;
+    } else if (sample == aptValue) {
+      if (++aptMatches >= TRNG_HEALTH_APT_CUTOFF) {
+        alarm = true;
+      }
+    }
+    if (++aptSamples == TRNG_HEALTH_APT_WINDOW) {
+      aptSamples = 0;
+    }
+  }
+
+  volatile bool alarm; // set from the TRNG interrupt
+  uint8_t rctValue;
+  uint8_t rctCount;
+  uint8_t aptValue;
+  uint16_t aptMatches;
+  uint16_t aptSamples;
+};
+
+#endif // TRNG_HEALTH_TEST_H
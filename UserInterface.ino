@@ -1,5 +1,8 @@
 #define TRANSEC_KEY_MAX_LENGTH 32
 
+// This sketch has no hop clock, so it only changes the key while FHSS is
+// stopped. Switching keys at a hop without stopping is done by the setkey
+// and otar commands of FHSS_TRANSEC_SAMD51_SPI.ino (see TransecKeyRing.h).
 char transecKey[TRANSEC_KEY_MAX_LENGTH];
 bool isFHSSActive = false;
 
@@ -11,7 +14,7 @@ void setup() {
   Serial.println("Commands:");
   Serial.println("  start - Start FHSS");
   Serial.println("  stop - Stop FHSS");
-  Serial.println("  setkey <key> - Set TRANSEC Key");
+  Serial.println("  setkey <key> - Set TRANSEC Key (FHSS stopped)");
   Serial.println("  status - Display System Status");
 }
 
@@ -30,9 +33,14 @@ void loop() {
       // Stop the FHSS system here
     } else if (command.startsWith("setkey ")) {
       String key = command.substring(7);
-      setTransecKey(key);
-      Serial.println("TRANSEC Key set to: " + key);
-      // Set the TRANSEC key here
+      if (isFHSSActive) {
+        // This sketch has no hop clock to schedule a rollover on, so the key
+        // is only replaced while nothing is hopping on it
+        Serial.println("Stop FHSS before setting the key.");
+      } else {
+        setTransecKey(key);
+        Serial.println("TRANSEC Key set to: " + key);
+      }
     } else if (command == "status") {
       displayStatus();
     } else {